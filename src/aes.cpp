@@ -1,13 +1,13 @@
 #include "aes.hpp"
 
-#include <array>
+#include <algorithm>
+#include <cassert>
+#include <cstring>
 #include <random>
 
-#include <immintrin.h>
-
 // see https://www.intel.com/content/dam/doc/white-paper/advanced-encryption-standard-new-instructions-set-paper.pdf
 
-__m128i AES_128_ASSIST(__m128i temp1, __m128i temp2) {
+static __m128i AES_128_ASSIST(__m128i temp1, __m128i temp2) {
     __m128i temp3;
     temp2 = _mm_shuffle_epi32(temp2, 0xff);
     temp3 = _mm_slli_si128(temp1, 0x4);
@@ -20,7 +20,7 @@ __m128i AES_128_ASSIST(__m128i temp1, __m128i temp2) {
     return temp1;
 }
 
-auto expandKey(const std::array<uint8_t, 16>& key) {
+static auto expandKey(const std::array<uint8_t, 16>& key) {
     std::array<__m128i, 11> Key_Schedule;
 
     // normal key expansion
@@ -56,6 +56,17 @@ auto expandKey(const std::array<uint8_t, 16>& key) {
     return Key_Schedule;
 }
 
+AesKey::AesKey(const std::array<uint8_t, 16>& key) {
+    auto schedule = expandKey(key);
+    std::copy(schedule.begin(), schedule.end(), enc);
+
+    dec[0] = enc[10];
+    for(int i = 1; i < 10; ++i) {
+        dec[i] = _mm_aesimc_si128(enc[10 - i]);
+    }
+    dec[10] = enc[0];
+}
+
 #if defined(_MSC_VER) && !defined(__clang__)
 inline __m128i operator^(__m128i a, __m128i b) {
     return _mm_xor_si128(a, b);
@@ -67,80 +78,191 @@ inline bool eq(__m128i a, __m128i b) {
     return _mm_test_all_zeros(v, v);
 }
 
-std::vector<uint8_t> encrypt(std::span<const uint8_t> data, const std::array<uint8_t, 16>& key) {
-    auto _key = expandKey(key);
+static __m128i encrypt_block(const AesKey& key, __m128i val) {
+    val = val ^ key.enc[0];
+    for(int i = 1; i < 10; i++) {
+        val = _mm_aesenc_si128(val, key.enc[i]);
+    }
+    return _mm_aesenclast_si128(val, key.enc[10]);
+}
+
+AesEncryptor::AesEncryptor(const AesKey& key, const std::array<uint8_t, 16>& iv, std::span<uint8_t> out) : key(key) {
+    assert(out.size() >= 0x20);
+
+    prev = _mm_loadu_si128((const __m128i*)iv.data());
+    _mm_storeu_si128((__m128i*)out.data(), prev);
 
-    auto length = data.size();
-    auto data_ = (__m128i*)data.data();
+    // first block is the key itself so decrypt can check if the key is correct
+    prev = encrypt_block(key, key.enc[0] ^ prev);
+    _mm_storeu_si128((__m128i*)out.data() + 1, prev);
+}
 
-    std::vector<uint8_t> out((length & (~0xF)) + ((length & 0xF) != 0) * 16 + 0x20);
+size_t AesEncryptor::update(std::span<const uint8_t> data, std::span<uint8_t> out) {
     auto out_ptr = (__m128i*)out.data();
+    size_t written = 0;
 
-    std::random_device rd;
-    std::default_random_engine re(rd());
-    std::uniform_int_distribution<uint32_t> dist;
+    // complete the block left over from the last call
+    if(pending_size != 0) {
+        auto count = std::min(16 - pending_size, data.size());
+        std::copy_n(data.begin(), count, pending.begin() + pending_size);
+        pending_size += count;
+        data = data.subspan(count);
 
-    std::array<uint8_t, 16> iv;
-    for(size_t i = 0; i < 16; i++) {
-        iv[i] = dist(re);
+        if(pending_size < 16) return 0;
+
+        assert(out.size() >= 16);
+        prev = encrypt_block(key, _mm_loadu_si128((const __m128i*)pending.data()) ^ prev);
+        _mm_storeu_si128(out_ptr++, prev);
+        written += 16;
+        pending_size = 0;
     }
 
-    *out_ptr = *(__m128i*)iv.data();
-    out_ptr++;
+    auto blocks = data.size() >> 4;
+    assert(out.size() >= written + blocks * 16);
 
-    auto step = [&](__m128i val) {
-        val = val ^ _key[0];
-        for(int i = 1; i < 10; i++) {
-            val = _mm_aesenc_si128(val, _key[i]);
-        }
-        *out_ptr = _mm_aesenclast_si128(val, _key[10]);
-        out_ptr++;
-    };
+    auto in_ptr = (const __m128i*)data.data();
+    for(size_t i = 0; i < blocks; i++) {
+        prev = encrypt_block(key, _mm_loadu_si128(in_ptr + i) ^ prev);
+        _mm_storeu_si128(out_ptr++, prev);
+    }
+    written += blocks * 16;
+
+    pending_size = data.size() & 0xF;
+    std::copy_n(data.begin() + blocks * 16, pending_size, pending.begin());
+
+    return written;
+}
+
+size_t AesEncryptor::finish(std::span<uint8_t> out) {
+    if(pending_size == 0) return 0;
+    assert(out.size() >= 16);
+
+    // zero padding
+    std::fill(pending.begin() + pending_size, pending.end(), 0);
+    prev = encrypt_block(key, _mm_loadu_si128((const __m128i*)pending.data()) ^ prev);
+    _mm_storeu_si128((__m128i*)out.data(), prev);
+    pending_size = 0;
+
+    return 16;
+}
+
+std::array<uint8_t, 16> make_iv(std::span<const uint8_t> data, const AesKey& key, bool deterministic) {
+    std::array<uint8_t, 16> iv;
 
-    step(_key[0] ^ *(out_ptr - 1));
+    if(!deterministic) {
+        // seeding is expensive so every thread keeps its own engine around
+        thread_local std::mt19937_64 engine(std::random_device {}());
 
-    for(size_t i = 0; i < (length >> 4); i++) {
-        step(data_[i] ^ *(out_ptr - 1));
+        auto a = engine(), b = engine();
+        std::memcpy(iv.data(), &a, 8);
+        std::memcpy(iv.data() + 8, &b, 8);
+        return iv;
     }
-    if((length & 0xF) != 0) {
-        std::array<uint8_t, 16> buf {0};
-        for(size_t i = 0; i < (length & 0xF); ++i) {
-            buf[i] = data[(length & (~0xF)) + i];
-        }
-        step(*(__m128i*)buf.data() ^ *(out_ptr - 1));
+
+    // single aes round per block as mixing function, followed by a full encryption of the result
+    __m128i h = _mm_set_epi64x((int64_t)data.size(), 0);
+    auto in_ptr = (const __m128i*)data.data();
+    for(size_t i = 0; i < (data.size() >> 4); i++) {
+        h = _mm_aesenc_si128(h ^ _mm_loadu_si128(in_ptr + i), key.enc[1]);
     }
+    std::array<uint8_t, 16> tail {};
+    std::copy(data.end() - (data.size() & 0xF), data.end(), tail.begin());
+    h = _mm_aesenc_si128(h ^ _mm_loadu_si128((const __m128i*)tail.data()), key.enc[1]);
+
+    _mm_storeu_si128((__m128i*)iv.data(), encrypt_block(key, h));
+    return iv;
+}
+
+void encrypt(std::span<const uint8_t> data, const AesKey& key, std::span<uint8_t> out, bool deterministic_iv) {
+    assert(out.size() == encrypted_size(data.size()));
+
+    AesEncryptor encryptor(key, make_iv(data, key, deterministic_iv), out);
+    auto written = 0x20 + encryptor.update(data, out.subspan(0x20));
+    encryptor.finish(out.subspan(written));
+}
+
+void encrypt_append(std::span<const uint8_t> data, const AesKey& key, std::vector<uint8_t>& out, bool deterministic_iv) {
+    auto offset = out.size();
+    out.resize(offset + encrypted_size(data.size()));
+    encrypt(data, key, std::span(out).subspan(offset), deterministic_iv);
+}
 
+std::vector<uint8_t> encrypt(std::span<const uint8_t> data, const AesKey& key, bool deterministic_iv) {
+    std::vector<uint8_t> out(encrypted_size(data.size()));
+    encrypt(data, key, out, deterministic_iv);
     return out;
 }
 
-bool decrypt(std::span<const uint8_t> data, const std::array<uint8_t, 16>& key, std::vector<uint8_t>& out) {
-    auto _key = expandKey(key);
+// CBC decrypt blocks. in points to the block before the first cipher block (the iv).
+// the blocks don't depend on each other so 8 are kept in flight to hide the aesdec latency
+static void decrypt_blocks(const __m128i* round_keys, const uint8_t* in, uint8_t* out, size_t blocks) {
+    size_t i = 0;
 
-    __m128i inv_key[9];
-    for(int i = 0; i < 9; ++i) {
-        inv_key[i] = _mm_aesimc_si128(_key[i + 1]);
+    for(; i + 8 <= blocks; i += 8) {
+        auto src = (const __m128i*)in + i;
+
+        __m128i b0 = _mm_loadu_si128(src + 1) ^ round_keys[0];
+        __m128i b1 = _mm_loadu_si128(src + 2) ^ round_keys[0];
+        __m128i b2 = _mm_loadu_si128(src + 3) ^ round_keys[0];
+        __m128i b3 = _mm_loadu_si128(src + 4) ^ round_keys[0];
+        __m128i b4 = _mm_loadu_si128(src + 5) ^ round_keys[0];
+        __m128i b5 = _mm_loadu_si128(src + 6) ^ round_keys[0];
+        __m128i b6 = _mm_loadu_si128(src + 7) ^ round_keys[0];
+        __m128i b7 = _mm_loadu_si128(src + 8) ^ round_keys[0];
+
+        for(int r = 1; r < 10; r++) {
+            auto k = round_keys[r];
+            b0 = _mm_aesdec_si128(b0, k);
+            b1 = _mm_aesdec_si128(b1, k);
+            b2 = _mm_aesdec_si128(b2, k);
+            b3 = _mm_aesdec_si128(b3, k);
+            b4 = _mm_aesdec_si128(b4, k);
+            b5 = _mm_aesdec_si128(b5, k);
+            b6 = _mm_aesdec_si128(b6, k);
+            b7 = _mm_aesdec_si128(b7, k);
+        }
+
+        auto k = round_keys[10];
+        auto dst = (__m128i*)out + i;
+        _mm_storeu_si128(dst + 0, _mm_aesdeclast_si128(b0, k) ^ _mm_loadu_si128(src + 0));
+        _mm_storeu_si128(dst + 1, _mm_aesdeclast_si128(b1, k) ^ _mm_loadu_si128(src + 1));
+        _mm_storeu_si128(dst + 2, _mm_aesdeclast_si128(b2, k) ^ _mm_loadu_si128(src + 2));
+        _mm_storeu_si128(dst + 3, _mm_aesdeclast_si128(b3, k) ^ _mm_loadu_si128(src + 3));
+        _mm_storeu_si128(dst + 4, _mm_aesdeclast_si128(b4, k) ^ _mm_loadu_si128(src + 4));
+        _mm_storeu_si128(dst + 5, _mm_aesdeclast_si128(b5, k) ^ _mm_loadu_si128(src + 5));
+        _mm_storeu_si128(dst + 6, _mm_aesdeclast_si128(b6, k) ^ _mm_loadu_si128(src + 6));
+        _mm_storeu_si128(dst + 7, _mm_aesdeclast_si128(b7, k) ^ _mm_loadu_si128(src + 7));
     }
 
-    auto step = [&](__m128i val) {
-        val = val ^ _key[10];
-        for(int i = 9; i > 0; i--) {
-            val = _mm_aesdec_si128(val, inv_key[i - 1]);
+    // remaining blocks
+    for(; i < blocks; i++) {
+        auto src = (const __m128i*)in + i;
+
+        __m128i val = _mm_loadu_si128(src + 1) ^ round_keys[0];
+        for(int r = 1; r < 10; r++) {
+            val = _mm_aesdec_si128(val, round_keys[r]);
         }
-        return _mm_aesdeclast_si128(val, _key[0]);
-    };
+        _mm_storeu_si128((__m128i*)out + i, _mm_aesdeclast_si128(val, round_keys[10]) ^ _mm_loadu_si128(src));
+    }
+}
+
+bool check_key(std::span<const uint8_t> data, const AesKey& key) {
+    // iv + key check block + data
+    if(data.size() < 0x20 || (data.size() & 0xF) != 0)
+        return false;
 
-    auto data_ = (__m128i*)data.data();
     // first 16 bytes of decrypted data should be key again
-    if(!eq((step(data_[1]) ^ data_[0]), _key[0]))
+    __m128i check;
+    decrypt_blocks(key.dec, data.data(), (uint8_t*)&check, 1);
+    return eq(check, key.enc[0]);
+}
+
+bool decrypt(std::span<const uint8_t> data, const AesKey& key, std::vector<uint8_t>& out) {
+    if(!check_key(data, key))
         return false;
 
     out.resize(data.size() - 0x20);
-    auto out_ptr = (__m128i*)out.data();
-
-    auto len = ((data.size() & 0xf) != 0) + ((data.size() - 0x10) >> 4);
-    for(size_t i = 1; i < len; i += 1) {
-        out_ptr[i - 1] = step(data_[i + 1]) ^ data_[i];
-    }
+    decrypt_blocks(key.dec, data.data() + 0x10, out.data(), out.size() >> 4);
 
     return true;
 }
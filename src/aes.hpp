@@ -1,9 +1,53 @@
 #pragma once
 
+#include <array>
+#include <cstddef>
 #include <cstdint>
 #include <span>
 #include <vector>
 
-std::vector<uint8_t> encrypt(std::span<const uint8_t> data, const std::array<uint8_t, 16>& key);
+#include <immintrin.h>
 
-bool decrypt(std::span<const uint8_t> data, const std::array<uint8_t, 16>& key, std::vector<uint8_t>& out);
+// expanded round keys. expanding is fairly expensive so keys that are used often should be kept around
+struct AesKey {
+    __m128i enc[11]; // encryption round keys
+    __m128i dec[11]; // decryption round keys in the order they're applied
+
+    explicit AesKey(const std::array<uint8_t, 16>& key);
+};
+
+// iv + key check block + data padded to 16 bytes
+constexpr size_t encrypted_size(size_t length) {
+    return ((length + 0xF) & ~(size_t)0xF) + 0x20;
+}
+
+// CBC encryption of data that arrives in pieces. output is written directly to the callers buffer
+class AesEncryptor {
+    const AesKey& key;
+    __m128i prev;
+
+    std::array<uint8_t, 16> pending {};
+    size_t pending_size = 0;
+
+  public:
+    // writes the iv and key check block (0x20 bytes) to out
+    AesEncryptor(const AesKey& key, const std::array<uint8_t, 16>& iv, std::span<uint8_t> out);
+
+    // encrypts all complete blocks. returns the number of bytes written to out (multiple of 16, at most data.size() + 15)
+    size_t update(std::span<const uint8_t> data, std::span<uint8_t> out);
+    // pads and encrypts the remaining bytes. returns the number of bytes written to out (0 or 16)
+    size_t finish(std::span<uint8_t> out);
+};
+
+// random iv unless deterministic is set. in that case the iv is derived from the data so the same input always gives the same output
+std::array<uint8_t, 16> make_iv(std::span<const uint8_t> data, const AesKey& key, bool deterministic);
+
+// out has to be encrypted_size(data.size()) bytes
+void encrypt(std::span<const uint8_t> data, const AesKey& key, std::span<uint8_t> out, bool deterministic_iv = false);
+// appends the encrypted data to out
+void encrypt_append(std::span<const uint8_t> data, const AesKey& key, std::vector<uint8_t>& out, bool deterministic_iv = false);
+std::vector<uint8_t> encrypt(std::span<const uint8_t> data, const AesKey& key, bool deterministic_iv = false);
+
+// only decrypts the key check block at the start of the data
+bool check_key(std::span<const uint8_t> data, const AesKey& key);
+bool decrypt(std::span<const uint8_t> data, const AesKey& key, std::vector<uint8_t>& out);
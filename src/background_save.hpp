@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <optional>
+#include <string>
+
+#include "game_data.hpp"
+#include "journal.hpp"
+#include "windows/errors.hpp"
+
+// writes project folders on a worker thread so editing can continue while saving.
+// the assets are copied on the ui thread when the save starts so later edits don't end up in a half written save
+class BackgroundSave {
+    std::shared_ptr<const SaveSnapshot> snapshot;
+    std::future<void> task;
+    std::atomic<size_t> written = 0;
+    // journal records up to here are part of the running save
+    size_t journal_mark = 0;
+
+    // save requested while another one was still running. started once the current one is done
+    std::optional<std::string> queued;
+
+  public:
+    void start(GameData& data, const std::string& path) {
+        if(running()) {
+            queued = path;
+            return;
+        }
+
+        journal.sync(data, true);
+        journal_mark = journal.mark();
+
+        snapshot = std::make_shared<const SaveSnapshot>(data.snapshot(path));
+        written = 0;
+
+#ifdef __EMSCRIPTEN__
+        // no threads in the web build. runs on the next poll
+        constexpr auto policy = std::launch::deferred;
+#else
+        constexpr auto policy = std::launch::async;
+#endif
+        task = std::async(policy, [this, snapshot = snapshot]() {
+            GameData::write_snapshot(*snapshot, written);
+        });
+    }
+
+    // has to be called every frame. reports errors and starts queued saves
+    void poll(GameData& data) {
+        if(!task.valid()) return;
+        if(task.wait_for(std::chrono::seconds(0)) == std::future_status::timeout) return;
+
+        try {
+            task.get();
+        } catch(std::exception& e) {
+            data.save_failed(*snapshot);
+            error_dialog.error("Failed to save \"{}\": {}", snapshot->path, e.what());
+            journal_mark = 0;
+        }
+        // edits that are part of the save don't have to be recovered anymore
+        if(journal_mark != 0) {
+            try {
+                journal.rebase(Journal::path_for(snapshot->path, data.get_exe_path()), journal_mark);
+            } catch(std::exception& e) {
+                error_dialog.error("Failed to update journal: {}", e.what());
+            }
+        }
+        snapshot = nullptr;
+
+        if(queued) {
+            auto path = std::move(*queued);
+            queued = std::nullopt;
+            start(data, path);
+        }
+    }
+
+    // blocks until all pending saves are written
+    void finish(GameData& data) {
+        while(running()) {
+            task.wait();
+            poll(data);
+        }
+    }
+
+    bool running() const { return task.valid(); }
+
+    // 0-1
+    float progress() const {
+        if(!snapshot || snapshot->files.empty()) return 0;
+        return (float)written / snapshot->files.size();
+    }
+};
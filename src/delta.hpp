@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+// difference between two buffers of the same size stored as a ^ b with runs of zeros removed.
+// applying the delta to either buffer turns it into the other one.
+// format: repeated [zero count][literal count][literal bytes], counts are LEB128
+namespace xor_rle {
+    inline void write_count(std::vector<uint8_t>& out, size_t count) {
+        while(count >= 0x80) {
+            out.push_back((count & 0x7F) | 0x80);
+            count >>= 7;
+        }
+        out.push_back(count);
+    }
+
+    inline size_t read_count(std::span<const uint8_t> data, size_t& pos) {
+        size_t count = 0;
+        for(int shift = 0;; shift += 7) {
+            if(pos >= data.size()) throw std::runtime_error("invalid delta");
+            auto byte = data[pos++];
+            count |= (size_t)(byte & 0x7F) << shift;
+            if((byte & 0x80) == 0) return count;
+        }
+    }
+
+    // b may be empty in which case it's treated as all zeros
+    inline std::vector<uint8_t> encode(std::span<const uint8_t> a, std::span<const uint8_t> b = {}) {
+        assert(b.empty() || a.size() == b.size());
+        auto at = [&](size_t i) -> uint8_t { return b.empty() ? a[i] : a[i] ^ b[i]; };
+
+        std::vector<uint8_t> out;
+        size_t i = 0;
+        while(i < a.size()) {
+            auto start = i;
+            // skip zeros 8 bytes at a time
+            while(i + 8 <= a.size()) {
+                uint64_t x, y = 0;
+                std::memcpy(&x, &a[i], 8);
+                if(!b.empty()) std::memcpy(&y, &b[i], 8);
+                if(x != y) break;
+                i += 8;
+            }
+            while(i < a.size() && at(i) == 0) i++;
+            write_count(out, i - start);
+
+            // a single zero between differences is cheaper to keep as a literal
+            start = i;
+            while(i < a.size() && (at(i) != 0 || (i + 1 < a.size() && at(i + 1) != 0))) i++;
+            write_count(out, i - start);
+            for(auto j = start; j < i; j++) {
+                out.push_back(at(j));
+            }
+        }
+        return out;
+    }
+
+    // target ^= delta
+    inline void apply(std::span<uint8_t> target, std::span<const uint8_t> delta) {
+        size_t pos = 0, i = 0;
+        while(pos < delta.size()) {
+            i += read_count(delta, pos);
+            auto literal = read_count(delta, pos);
+            if(i + literal > target.size() || pos + literal > delta.size()) throw std::runtime_error("invalid delta");
+
+            for(size_t j = 0; j < literal; j++) {
+                target[i++] ^= delta[pos++];
+            }
+        }
+    }
+} // namespace xor_rle
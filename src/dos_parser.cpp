@@ -1,8 +1,10 @@
 #include "dos_parser.hpp"
 
+#include <algorithm>
 #include <cstring>
 #include <fstream>
 #include <span>
+#include <stdexcept>
 #include <vector>
 
 // mostly adapted from the ImHex PE pattern made by WerWolv
@@ -242,31 +244,48 @@ struct SectionHeader {
     SectionFlags characteristics;
 };
 
-SegmentData getSegmentOffsets(std::span<uint8_t> data) {
+SegmentData getSegmentOffsets(std::span<const uint8_t> data) {
     auto ptr = data.data();
+    if(data.size() < sizeof(DOSHeader)) {
+        throw std::runtime_error("file too small");
+    }
 
-    auto dos_header = (DOSHeader*)ptr;
+    auto dos_header = (const DOSHeader*)ptr;
     if(dos_header->signature != 0x5A4D) { // 'ZM'
         throw std::runtime_error("invalid dos header");
     }
-    auto coff_header_ptr = (COFFHeader*)(ptr + dos_header->coffHeaderPointer);
+    if(data.size() < dos_header->coffHeaderPointer + sizeof(COFFHeader) + sizeof(OptionalHeader)) {
+        throw std::runtime_error("invalid coff_header");
+    }
+    auto coff_header_ptr = (const COFFHeader*)(ptr + dos_header->coffHeaderPointer);
     if(coff_header_ptr->signature != 0x00004550) { // 'PE\0\0'
         throw std::runtime_error("invalid coff_header");
     }
-    auto coff_optional_header = (OptionalHeader*)(ptr + dos_header->coffHeaderPointer + sizeof(COFFHeader));
+    auto coff_optional_header = (const OptionalHeader*)(ptr + dos_header->coffHeaderPointer + sizeof(COFFHeader));
     if(coff_optional_header->magic != PEFormat::PE32Plus) {
         throw std::runtime_error("invalid coff_optional_header");
     }
-    auto section_ptr = (SectionHeader*)(ptr + dos_header->coffHeaderPointer + sizeof(COFFHeader) + coff_header_ptr->sizeOfOptionalHeader);
+    auto section_ptr = (const SectionHeader*)(ptr + dos_header->coffHeaderPointer + sizeof(COFFHeader) + coff_header_ptr->sizeOfOptionalHeader);
     auto image_base = coff_optional_header->imageBase;
+    if(data.size() < (size_t)((const uint8_t*)(section_ptr + coff_header_ptr->numberOfSections) - ptr)) {
+        throw std::runtime_error("invalid section table");
+    }
 
     uint32_t data_offset = 0;
-    std::span<uint8_t> dat;
-    std::span<uint8_t> rdata;
+    std::span<const uint8_t> dat;
+    std::span<const uint8_t> rdata;
     uint32_t rdata_offset = -1;
+    std::vector<Section> sections;
 
     for(size_t i = 0; i < coff_header_ptr->numberOfSections; i++) {
         auto& section = section_ptr[i];
+        if(section.ptrRawData + (size_t)section.sizeOfRawData > data.size()) {
+            throw std::runtime_error("section out of bounds");
+        }
+        // raw data is padded to the file alignment, only virtualSize bytes are part of the image
+        auto size = section.virtualSize == 0 ? section.sizeOfRawData : std::min(section.virtualSize, section.sizeOfRawData);
+        sections.push_back({section.rva, std::span(ptr + section.ptrRawData, size)});
+
         if(std::strcmp(section.name, ".data") == 0) {
             dat = std::span(ptr + section.ptrRawData, section.sizeOfRawData);
             data_offset = section.rva;
@@ -281,6 +300,55 @@ SegmentData getSegmentOffsets(std::span<uint8_t> data) {
         dat,
         rdata_offset,
         rdata,
-        image_base
+        image_base,
+        std::move(sections)
     };
 }
+
+static uint32_t align(uint32_t value, uint32_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+uint32_t appendSection(std::vector<uint8_t>& exe, const char* name, std::span<const uint8_t> data) {
+    // validates the headers
+    getSegmentOffsets(exe);
+
+    auto ptr = exe.data();
+    auto dos_header = (DOSHeader*)ptr;
+    auto coff_header = (COFFHeader*)(ptr + dos_header->coffHeaderPointer);
+    auto optional_header = (OptionalHeader*)(ptr + dos_header->coffHeaderPointer + sizeof(COFFHeader));
+    auto sections = (SectionHeader*)(ptr + dos_header->coffHeaderPointer + sizeof(COFFHeader) + coff_header->sizeOfOptionalHeader);
+
+    uint32_t first_raw = optional_header->sizeOfHeaders;
+    uint32_t virt_end = 0;
+    for(size_t i = 0; i < coff_header->numberOfSections; i++) {
+        if(sections[i].sizeOfRawData != 0) first_raw = std::min(first_raw, sections[i].ptrRawData);
+        virt_end = std::max(virt_end, sections[i].rva + std::max(sections[i].virtualSize, sections[i].sizeOfRawData));
+    }
+
+    // the new header has to fit between the section table and the first section
+    auto header_end = (const uint8_t*)(sections + coff_header->numberOfSections + 1) - ptr;
+    if(header_end > first_raw) {
+        throw std::runtime_error("no space for another section header");
+    }
+
+    SectionHeader section {};
+    std::strncpy(section.name, name, sizeof(section.name));
+    section.virtualSize = data.size();
+    section.rva = align(virt_end, optional_header->virtualSectionAlignment);
+    section.sizeOfRawData = align(data.size(), optional_header->rawSectionAlignment);
+    section.ptrRawData = align(exe.size(), optional_header->rawSectionAlignment);
+    const uint32_t flags = 0x40000040; // initialized data, readable
+    std::memcpy(&section.characteristics, &flags, sizeof(flags));
+
+    sections[coff_header->numberOfSections] = section;
+    coff_header->numberOfSections++;
+    optional_header->sizeOfImage = align(section.rva + section.virtualSize, optional_header->virtualSectionAlignment);
+    optional_header->sizeOfInitializedData += section.sizeOfRawData;
+
+    // pointers are invalidated here
+    exe.resize(section.ptrRawData + section.sizeOfRawData);
+    std::copy(data.begin(), data.end(), exe.begin() + section.ptrRawData);
+
+    return section.rva;
+}
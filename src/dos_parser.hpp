@@ -2,24 +2,50 @@
 
 #include <cstdint>
 #include <span>
+#include <stdexcept>
+#include <vector>
+
+struct Section {
+    uint32_t virt_addr;
+    std::span<const uint8_t> data;
+};
 
 struct SegmentData {
     uint32_t data_virt_addr;
-    std::span<uint8_t> data;
+    std::span<const uint8_t> data;
 
     uint32_t rdata_virt_addr;
-    std::span<uint8_t> rdata;
+    std::span<const uint8_t> rdata;
 
     uint64_t image_base;
 
-    std::span<uint8_t> get_data_ptr(uint64_t ptr, size_t length = -1) {
+    std::span<const uint8_t> get_data_ptr(uint64_t ptr, size_t length = -1) const {
          // assert(sections.rdata.size() >= asset.ptr - sections.rdata_pointer_offset + asset.length);
          return data.subspan(ptr - image_base - data_virt_addr, length);
     }
-    std::span<uint8_t> get_rdata_ptr(uint64_t ptr, size_t length = -1) {
+    std::span<const uint8_t> get_rdata_ptr(uint64_t ptr, size_t length = -1) const {
         // assert(sections.rdata.size() >= asset.ptr - sections.rdata_pointer_offset + asset.length);
         return rdata.subspan(ptr - image_base - rdata_virt_addr, length);
     }
+
+    // all sections. assets moved by the editor live in their own section
+    std::vector<Section> sections;
+
+    // resolves ptr against whichever section contains it
+    std::span<const uint8_t> get_ptr(uint64_t ptr, size_t length) const {
+        auto rva = ptr - image_base;
+        for(auto& section : sections) {
+            if(rva < section.virt_addr || rva - section.virt_addr >= section.data.size()) continue;
+
+            auto offset = rva - section.virt_addr;
+            if(length > section.data.size() - offset) break;
+            return section.data.subspan(offset, length);
+        }
+        throw std::runtime_error("pointer outside of exe sections");
+    }
 };
 
-SegmentData getSegmentOffsets(std::span<uint8_t> data);
+SegmentData getSegmentOffsets(std::span<const uint8_t> data);
+
+// adds an initialized read only section with the given data at the end of the exe. returns its virtual address (without image base)
+uint32_t appendSection(std::vector<uint8_t>& exe, const char* name, std::span<const uint8_t> data);
@@ -2,10 +2,22 @@
 
 #include <algorithm>
 #include <chrono>
+#include <cstdio>
 #include <filesystem>
 #include <fstream>
+#include <sstream>
+#include <variant>
 
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "aes.hpp"
 #include "dos_parser.hpp"
+#include "hash.hpp"
+#include "parallel.hpp"
 #include "windows/errors.hpp"
 
 std::unordered_map<int, size_t> knownHashes = {
@@ -181,12 +193,16 @@ std::vector<uint8_t> readFile(const std::string& path) {
     if(!std::filesystem::exists(path))
         throw std::runtime_error("File not found");
 
-    std::ifstream testFile(path, std::ios::binary);
-    testFile.exceptions(std::ifstream::badbit | std::ifstream::failbit);
-    return std::vector<uint8_t>(std::istreambuf_iterator(testFile), std::istreambuf_iterator<char>());
+    std::ifstream file(path, std::ios::binary);
+    file.exceptions(std::ifstream::badbit | std::ifstream::failbit);
+
+    std::vector<uint8_t> data(std::filesystem::file_size(path));
+    file.read((char*)data.data(), data.size());
+    return data;
 }
 
-static size_t hash(const std::vector<uint8_t>& data) {
+// fnv. only used for checking against knownHashes, everything else uses fast_hash
+static size_t legacy_hash(std::span<const uint8_t> data) {
     size_t result = 2166136261U;
     for(auto&& el : data) {
         result = (16777619 * result) ^ el;
@@ -195,7 +211,7 @@ static size_t hash(const std::vector<uint8_t>& data) {
 }
 
 template<typename T>
-bool equal(const std::vector<T>& a, const std::vector<T>& b) {
+bool equal(std::span<const T> a, std::span<const T> b) {
     if(a.size() != b.size())
         return false;
 
@@ -206,29 +222,110 @@ bool equal(const std::vector<T>& a, const std::vector<T>& b) {
     return true;
 }
 
-// only write the file if the hash has changed
-static void writeFileIfChanged(const std::filesystem::path& path, const std::vector<uint8_t>& data, int assetId) {
-    // printf(std::format("{} {}\n", assetId, hash(data)).c_str());
+// only used from the ui thread since it fills in vanilla_hashes
+bool GameData::is_vanilla(std::span<const uint8_t> data, int assetId) const {
+    auto h = fast_hash(data);
 
+    auto it = vanilla_hashes.find(assetId);
+    if(it != vanilla_hashes.end()) {
+        return it->second == h;
+    }
+
+    // first time this asset is checked. fall back to the slow hash from the table
     assert(knownHashes.contains(assetId));
-    if(hash(data) != knownHashes[assetId]) {
-        std::ofstream file(path, std::ios::binary);
-        file.exceptions(std::ofstream::failbit | std::ofstream::badbit);
-        file.write((char*)data.data(), data.size());
+    if(legacy_hash(data) != knownHashes.at(assetId)) {
+        return false;
+    }
+    vanilla_hashes[assetId] = h;
+    return true;
+}
+
+// doesn't touch any GameData state so it's safe to call from the save thread
+static bool matches_vanilla(std::span<const uint8_t> data, uint64_t hash, const SaveSnapshot::File& file) {
+    if(file.vanilla_hash) return hash == *file.vanilla_hash;
+
+    assert(knownHashes.contains(file.asset_id));
+    return legacy_hash(data) == knownHashes.at(file.asset_id);
+}
+
+// files starting with a dot are ignored by load_folder
+static std::filesystem::path temp_path(const std::filesystem::path& path) {
+    return path.parent_path() / ("." + path.filename().string() + ".tmp");
+}
+
+// writes data to a temporary file next to path and makes sure it actually reached the disk.
+// renaming it over path afterwards replaces the file in one step so a crash never leaves a half written file behind
+static std::filesystem::path write_temp_file(const std::filesystem::path& path, std::span<const uint8_t> data) {
+    auto tmp = temp_path(path);
+
+    FILE* file = std::fopen(tmp.string().c_str(), "wb");
+    if(file == nullptr) {
+        throw std::runtime_error(std::format("Failed to open \"{}\"", tmp.string()));
+    }
+
+    bool ok = std::fwrite(data.data(), 1, data.size(), file) == data.size() && std::fflush(file) == 0;
+#ifdef _WIN32
+    ok = ok && _commit(_fileno(file)) == 0;
+#else
+    ok = ok && fsync(fileno(file)) == 0;
+#endif
+    ok = std::fclose(file) == 0 && ok;
+
+    if(!ok) {
+        std::error_code ec;
+        std::filesystem::remove(tmp, ec);
+        throw std::runtime_error(std::format("Failed to write \"{}\"", tmp.string()));
+    }
+    return tmp;
+}
+
+// file name -> fast_hash of every file written by the editor.
+// written last so the files only count as saved once all of them were replaced
+using Manifest = std::unordered_map<std::string, uint64_t>;
+constexpr const char* manifest_name = "manifest.txt";
+
+static Manifest read_manifest(const std::filesystem::path& path) {
+    Manifest manifest;
+
+    std::ifstream file(path);
+    std::string name;
+    uint64_t hash;
+    while(file >> name >> std::hex >> hash) {
+        manifest[name] = hash;
     }
+    return manifest;
+}
+
+static std::vector<uint8_t> serialize_manifest(const Manifest& manifest) {
+    std::vector<std::pair<std::string, uint64_t>> entries(manifest.begin(), manifest.end());
+    std::sort(entries.begin(), entries.end());
+
+    std::ostringstream out;
+    for(auto& [name, hash] : entries) {
+        out << name << ' ' << std::format("{:016x}", hash) << '\n';
+    }
+    auto str = out.str();
+    return std::vector<uint8_t>(str.begin(), str.end());
+}
+
+static void write_file_atomic(const std::filesystem::path& path, std::span<const uint8_t> data) {
+    write_temp_file(path, data);
+    std::filesystem::rename(temp_path(path), path);
 }
 
 GameData GameData::load_exe(const std::string& path) {
     GameData data;
-    data.raw = readFile(path);
-    data.sections = getSegmentOffsets(data.raw);
+    data.exe = MappedFile(path);
+    data.exe_path = std::filesystem::absolute(path).string();
+    data.sections = getSegmentOffsets(data.exe.span());
 
-    assert(data.sections.data.size() >= sizeof(asset_entry) * 676);
-    data.assets = std::span((const asset_entry*)data.sections.data.data(), 676);
+    assert(data.sections.data.size() >= sizeof(asset_entry) * asset_count);
+    data.assets = std::span((const asset_entry*)data.sections.data.data(), asset_count);
 
     data.bufferFromExe();
     if(!data.testAssetHashes()) {
         error_dialog.warning("Loaded exe differs from unmodified game files.");
+        data.hash_warning_shown = true;
     }
 
     data.loaded = true;
@@ -256,151 +353,534 @@ static int readInt(const std::string& str) {
 }
 
 void GameData::load_folder(const std::string& path) {
-    bufferFromExe(); // reload original assets
-
     std::unordered_map<int, std::string> files;
     for(auto& item : std::filesystem::directory_iterator(path)) {
         if(!item.is_regular_file()) continue;
 
-        int id = readInt(item.path().filename().string());
+        auto name = item.path().filename().string();
+        if(name.starts_with('.') && name.ends_with(".tmp")) {
+            // left over from a save that didn't finish. the real file was never replaced
+            std::error_code ec;
+            std::filesystem::remove(item.path(), ec);
+            continue;
+        }
+
+        int id = readInt(name);
         if(id == -1) continue;
         if(files.contains(id)) error_dialog.warning("multiple files with the same id found in project folder.");
         files[id] = item.path().string();
     }
 
-    auto getAsset = [&](int id) -> std::optional<std::vector<uint8_t>> {
-        if(!files.contains(id)) return std::nullopt;
+    bufferFromExe(); // reload original assets
+    overrides = std::move(files);
+    project_path = path;
+
+    auto manifest = read_manifest(std::filesystem::path(path) / manifest_name);
+    for(auto& [id, file] : overrides) {
+        auto it = manifest.find(std::filesystem::path(file).filename().string());
+        if(it != manifest.end()) saved_hashes[id] = it->second;
+    }
 
-        std::ifstream testFile(files[id], std::ios::binary);
-        testFile.exceptions(std::ifstream::badbit | std::ifstream::failbit);
-        return std::vector<uint8_t>(std::istreambuf_iterator(testFile), std::istreambuf_iterator<char>());
+    // error is reported by the caller since this runs on worker threads
+    auto getAsset = [&](int id, std::string& error) -> std::optional<std::vector<uint8_t>> {
+        error.clear();
+        auto it = overrides.find(id);
+        if(it == overrides.end()) return std::nullopt;
+        auto data = readFile(it->second);
+        error = check_saved_hash(id, data);
+        return data;
     };
 
-    for(size_t i = 0; i < 5; i++) {
-        if(auto data = getAsset(mapIds[i])) {
-            auto map = Map(*data);
-            if(map.coordinate_map != maps[i].coordinate_map) {
-                error_dialog.warning("Map structure differs from previously loaded map.\nMight break things so be careful.");
-            }
-            maps[i] = map;
-        }
+    // small assets are still loaded right away. maps and images are decoded on first use
+    std::array<std::optional<SpriteData>, std::size(spriteMapping)> loaded_sprites;
+    std::array<std::string, std::size(spriteMapping)> errors;
+    parallel_for(loaded_sprites.size(), [&](size_t i) {
+        if(auto data = getAsset(spriteMapping[i].asset_id, errors[i])) loaded_sprites[i].emplace(*data);
+    });
+    for(size_t i = 0; i < loaded_sprites.size(); i++) {
+        if(!errors[i].empty()) error_dialog.warning(errors[i]);
+        if(loaded_sprites[i]) sprites[spriteMapping[i].tile_id] = std::move(*loaded_sprites[i]);
     }
 
-    for(const auto [_, asset_id, tile_id] : spriteMapping) {
-        if(auto data = getAsset(asset_id)) sprites[tile_id] = SpriteData(*data);
+    std::string error;
+    if(auto uvs_ = getAsset(254, error)) uvs = uv_data::load(*uvs_);
+    if(!error.empty()) error_dialog.warning(error);
+    if(auto ambient_ = getAsset(179, error)) ambient = LightingData::parse(*ambient_);
+    if(!error.empty()) error_dialog.warning(error);
+}
+
+void GameData::save_folder(const std::string& path) {
+    std::atomic<size_t> progress = 0;
+    auto snap = snapshot(path);
+    try {
+        write_snapshot(snap, progress);
+    } catch(...) {
+        save_failed(snap);
+        throw;
     }
+}
 
-    if(auto uvs_ = getAsset(254)) uvs = uv_data::load(*uvs_);
-    if(auto ambient_ = getAsset(179)) ambient = LightingData::parse(*ambient_);
-    if(auto atlas_ = getAsset(255)) atlas = Image(*atlas_);
-    if(auto bunny_ = getAsset(30)) bunny = Image(*bunny_);
-    if(auto time_capsule_ = getAsset(277)) time_capsule = Image(*time_capsule_);
+SaveSnapshot GameData::snapshot(const std::string& path) {
+    SaveSnapshot snapshot;
+    snapshot.path = path;
+    snapshot.previous_project_path = project_path;
 
-    for(size_t i = 11; i <= 24; i++) {
-        if(auto bg = getAsset(i)) backgrounds[i - 11] = Image(*bg);
+    // the project folder already contains everything that wasn't modified.
+    // a different folder gets every asset that isn't vanilla
+    std::error_code ec;
+    const bool full = project_path.empty() || !std::filesystem::equivalent(path, project_path, ec);
+
+    auto needs_save = [&](int asset_id, bool decoded) {
+        if(full) return decoded || overrides.contains(asset_id);
+        return dirty.contains(asset_id);
+    };
+    auto add = [&](int asset_id, std::string name) -> SaveSnapshot::File& {
+        auto& file = snapshot.files.emplace_back();
+        file.asset_id = asset_id;
+        file.name = std::move(name);
+
+        auto it = vanilla_hashes.find(asset_id);
+        if(it != vanilla_hashes.end()) file.vanilla_hash = it->second;
+
+        saved_hashes.erase(asset_id);
+        return file;
+    };
+
+    for(size_t i = 0; i < 5; i++) {
+        if(!needs_save(mapIds[i], maps[i].has_value())) continue;
+        add(mapIds[i], std::format("{}.map", mapIds[i])).data = map(i).save();
     }
-    // index 25 is skipped for some reason
-    if(auto bg = getAsset(26)) backgrounds[14] = Image(*bg);
+    for(const auto [_, asset_id, tile_id] : spriteMapping) {
+        if(!needs_save(asset_id, true)) continue;
+        add(asset_id, std::format("{}.sprite", asset_id)).data = sprites.at(tile_id).save();
+    }
+
+    if(needs_save(254, true)) add(254, "254.tiles").data = uv_data::save(uvs);
+    if(needs_save(179, true)) add(179, "179.ambient").data = LightingData::save(ambient);
+    if(needs_save(255, images.contains(255))) add(255, "255.png").image = atlas().copy();
+
+    // edits made from now on belong to the next save
+    dirty.clear();
+    project_path = path;
+
+    return snapshot;
 }
 
-void GameData::save_folder(const std::string& path) const {
-    auto p = std::filesystem::path(path);
+void GameData::write_snapshot(const SaveSnapshot& snapshot, std::atomic<size_t>& progress) {
+    auto p = std::filesystem::path(snapshot.path);
     std::filesystem::create_directories(p);
 
     // rename .uvs to .tiles
     if(std::filesystem::exists(p / "254.uvs")) std::filesystem::rename(p / "254.uvs", p / "254.tiles");
-    backup_assets(path);
+    backup_assets(snapshot.path);
+
+    auto manifest = read_manifest(p / manifest_name);
+    std::vector<std::filesystem::path> written;
+
+    // everything goes to temporary files first. the real files are only replaced once all of them were written successfully
+    try {
+        for(auto& file : snapshot.files) {
+            std::vector<uint8_t> png;
+            std::span<const uint8_t> data = file.data;
+            if(file.image) {
+                png = file.image->save_png();
+                data = png;
+            }
+
+            // only write the file if it differs from the vanilla asset
+            auto hash = fast_hash(data);
+            if(!matches_vanilla(data, hash, file)) {
+                written.push_back(p / file.name);
+                write_temp_file(written.back(), data);
+                manifest[file.name] = hash;
+            }
+            progress++;
+        }
+    } catch(...) {
+        std::error_code ec;
+        for(auto& path : written) {
+            std::filesystem::remove(temp_path(path), ec);
+        }
+        throw;
+    }
+
+    for(auto& path : written) {
+        std::filesystem::rename(temp_path(path), path);
+    }
+    // committing the manifest marks the save as complete
+    if(!written.empty()) {
+        write_file_atomic(p / manifest_name, serialize_manifest(manifest));
+    }
+}
+
+void GameData::save_failed(const SaveSnapshot& snapshot) {
+    // something else was loaded while saving
+    if(project_path != snapshot.path) return;
 
+    for(auto& file : snapshot.files) {
+        dirty.insert(file.asset_id);
+    }
+    // a failed full save has to be a full save again
+    project_path = snapshot.previous_project_path;
+}
+
+void GameData::save_exe(const std::string& path) const {
+    // current data of every asset that might have been edited
+    std::vector<std::pair<int, std::vector<uint8_t>>> edited;
     for(size_t i = 0; i < 5; i++) {
-        writeFileIfChanged(p / std::format("{}.map", mapIds[i]), maps[i].save(), mapIds[i]);
+        if(maps[i] || overrides.contains(mapIds[i])) edited.emplace_back(mapIds[i], map(i).save());
     }
     for(const auto [_, asset_id, tile_id] : spriteMapping) {
-        writeFileIfChanged(p / std::format("{}.sprite", asset_id), sprites.at(tile_id).save(), asset_id);
+        edited.emplace_back(asset_id, sprites.at(tile_id).save());
+    }
+    edited.emplace_back(254, uv_data::save(uvs));
+    edited.emplace_back(179, LightingData::save(ambient));
+    if(images.contains(255) || overrides.contains(255)) {
+        // the atlas is decoded on load and our png never matches the original bytes, so only compare pixels.
+        // an unchanged atlas keeps the original bytes which are skipped below
+        auto original = get_asset(255);
+        edited.emplace_back(255, atlas() == Image(original) ? std::move(original) : atlas().save_png());
+    }
+    // anything else in the project folder is used as is
+    for(auto& [id, file] : overrides) {
+        if(std::find_if(edited.begin(), edited.end(), [&](auto& el) { return el.first == id; }) == edited.end()) {
+            edited.emplace_back(id, readFile(file));
+        }
+    }
+
+    std::vector<uint8_t> out(exe.data(), exe.data() + exe.size());
+    const size_t table_offset = sections.data.data() - exe.data();
+    auto entry = [&](int id) -> asset_entry& { return ((asset_entry*)(out.data() + table_offset))[id]; };
+
+    // assets that don't fit in place anymore. placed in a new section with pointers fixed up afterwards
+    std::vector<uint8_t> extra;
+    std::vector<std::pair<int, size_t>> relocated;
+
+    std::vector<uint8_t> buffer;
+    for(auto& [id, data] : edited) {
+        auto original = get_asset(id, buffer);
+        if(equal<uint8_t>(original, data)) continue;
+
+        auto& asset = entry(id);
+        std::vector<uint8_t> payload;
+        if(((uint8_t)asset.type & 192) == 64) {
+            int key = getKeyIndex(id);
+            if(key == -1) throw std::runtime_error(std::format("Unknown encryption key for asset {}", id));
+            // deterministic iv so exporting the same data twice gives the same exe
+            payload = encrypt(data, key, true);
+        } else {
+            payload = std::move(data);
+        }
+
+        if(payload.size() <= asset.length) {
+            // might be in .rdata or in a section added by an earlier export
+            auto offset = sections.get_ptr(asset.ptr, asset.length).data() - exe.data();
+            std::copy(payload.begin(), payload.end(), out.begin() + offset);
+        } else {
+            extra.resize((extra.size() + 15) & ~15); // keep aes blocks aligned
+            relocated.emplace_back(id, extra.size());
+            extra.insert(extra.end(), payload.begin(), payload.end());
+        }
+        asset.length = payload.size();
     }
 
-    writeFileIfChanged(p / "254.tiles", uv_data::save(uvs), 254);
-    writeFileIfChanged(p / "179.ambient", LightingData::save(ambient), 179);
+    if(!extra.empty()) {
+        auto rva = appendSection(out, ".awedit", extra);
+        for(auto [id, offset] : relocated) {
+            entry(id).ptr = sections.image_base + rva + offset;
+        }
+    }
 
-    writeFileIfChanged(p / "255.png", atlas.save_png(), 255);
+    write_file_atomic(path, out);
 }
 
-void GameData::backup_assets(const std::string& path) const {
+void GameData::mark_sprite_dirty(int tile_id) {
+    for(const auto [_, asset_id, tile_id_] : spriteMapping) {
+        if(tile_id_ == tile_id) mark_dirty(asset_id);
+    }
+}
+
+// backups/objects/<hash> stores every version of a file once.
+// backups/<date>.txt lists the files of the project folder at that time in the same format as the manifest
+void GameData::backup_assets(const std::string& path, bool always) {
     auto p = std::filesystem::path(path);
+    auto bp = p / "backups";
 
     const auto now = std::chrono::current_zone()->to_local(std::chrono::system_clock::now());
-    auto bp = p / "backups" / std::format("{:%Y-%m-%d %H-%M}", now);
+    auto snapshot_path = bp / std::format("{:%Y-%m-%d %H-%M}.txt", now);
 
     // backup with same name already exists. keep old backup
-    if(std::filesystem::exists(bp)) return;
-    std::filesystem::create_directories(bp);
+    if(!always && std::filesystem::exists(snapshot_path)) return;
 
+    Manifest manifest;
     for(auto& item : std::filesystem::directory_iterator(path)) {
         if(!item.is_regular_file()) continue;
 
-        int id = readInt(item.path().filename().string());
-        if(id == -1) continue;
+        auto name = item.path().filename().string();
+        if(readInt(name) == -1) continue;
 
-        std::filesystem::copy_file(item, bp / item.path().filename());
+        auto data = readFile(item.path().string());
+        auto hash = fast_hash(data);
+        manifest[name] = hash;
+
+        // unchanged files are already stored
+        auto object = bp / "objects" / std::format("{:016x}", hash);
+        if(!std::filesystem::exists(object)) {
+            std::filesystem::create_directories(object.parent_path());
+            write_file_atomic(object, data);
+        }
+    }
+    if(manifest.empty()) return;
+
+    // nothing changed since the last backup
+    auto backups = list_backups(path);
+    if(!backups.empty() && read_manifest(bp / (backups.back() + ".txt")) == manifest) return;
+
+    // another backup in the same minute
+    for(int i = 2; std::filesystem::exists(snapshot_path); i++) {
+        snapshot_path = bp / std::format("{:%Y-%m-%d %H-%M} ({}).txt", now, i);
     }
+    write_file_atomic(snapshot_path, serialize_manifest(manifest));
 }
 
-std::vector<uint8_t> GameData::get_asset(int id) {
-    assert(id >= 0 && id < assets.size());
-    auto& asset = assets[id];
-    auto dat = sections.get_rdata_ptr(asset.ptr, asset.length);
+std::vector<std::string> GameData::list_backups(const std::string& path) {
+    std::vector<std::string> result;
+
+    std::error_code ec;
+    for(auto& item : std::filesystem::directory_iterator(std::filesystem::path(path) / "backups", ec)) {
+        if(item.is_regular_file() && item.path().extension() == ".txt") {
+            result.push_back(item.path().stem().string());
+        }
+    }
+    // names are dates so this is oldest to newest
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+void GameData::restore_backup(const std::string& path, const std::string& name) {
+    auto p = std::filesystem::path(path);
+    auto bp = p / "backups";
+
+    auto manifest = read_manifest(bp / (name + ".txt"));
+    if(manifest.empty()) {
+        throw std::runtime_error(std::format("Backup \"{}\" not found", name));
+    }
+    for(auto& [file, hash] : manifest) {
+        if(!std::filesystem::exists(bp / "objects" / std::format("{:016x}", hash))) {
+            throw std::runtime_error(std::format("Backup \"{}\" is missing {}", name, file));
+        }
+    }
+
+    // so the restore can be undone. throws if the current state couldn't be stored
+    backup_assets(path, true);
+
+    // same as saving: replace the files only after all of them were written
+    try {
+        for(auto& [file, hash] : manifest) {
+            write_temp_file(p / file, readFile((bp / "objects" / std::format("{:016x}", hash)).string()));
+        }
+    } catch(...) {
+        std::error_code ec;
+        for(auto& [file, _] : manifest) {
+            std::filesystem::remove(temp_path(p / file), ec);
+        }
+        throw;
+    }
+    for(auto& [file, _] : manifest) {
+        std::filesystem::rename(temp_path(p / file), p / file);
+    }
 
+    // assets that didn't exist yet when the backup was made
+    for(auto& item : std::filesystem::directory_iterator(p)) {
+        auto file = item.path().filename().string();
+        if(item.is_regular_file() && readInt(file) != -1 && !manifest.contains(file)) {
+            std::filesystem::remove(item.path());
+        }
+    }
+
+    write_file_atomic(p / manifest_name, serialize_manifest(manifest));
+}
+
+std::vector<uint8_t> GameData::get_asset(int id) const {
     std::vector<uint8_t> buffer;
-    if(tryDecrypt(asset, dat, buffer)) {
+    auto dat = get_asset(id, buffer);
+    if(dat.data() == buffer.data()) {
         return buffer;
     }
     return std::vector<uint8_t>(dat.begin(), dat.end());
 }
 
-bool GameData::testAssetHashes() {
+std::span<const uint8_t> GameData::get_asset(int id, std::vector<uint8_t>& buffer) const {
+    assert(id >= 0 && id < (int)assets.size());
+    auto& asset = assets[id];
+    auto dat = sections.get_ptr(asset.ptr, asset.length);
+
+    if(tryDecrypt(asset, id, dat, buffer)) {
+        return buffer;
+    }
+    return dat;
+}
+
+Map& GameData::map(int index) {
+    assert(index >= 0 && index < 5);
+    if(maps[index]) return *maps[index];
+    return decode_map(index);
+}
+
+const Map& GameData::map(int index) const {
+    assert(index >= 0 && index < 5);
+    if(maps[index]) return *maps[index];
+    return decode_map(index);
+}
+
+Image& GameData::image(int asset_id) {
+    auto it = images.find(asset_id);
+    if(it != images.end()) return it->second;
+    return decode_image(asset_id);
+}
+
+const Image& GameData::image(int asset_id) const {
+    auto it = images.find(asset_id);
+    if(it != images.end()) return it->second;
+    return decode_image(asset_id);
+}
+
+void GameData::invalidate(int asset_id) {
     for(size_t i = 0; i < 5; i++) {
-        if(hash(maps[i].save()) != knownHashes[mapIds[i]])
-            return false;
+        if(mapIds[i] == asset_id) maps[i].reset();
     }
-    for(const auto [_, asset_id, tile_id] : spriteMapping) {
-        if(hash(sprites[tile_id].save()) != knownHashes[asset_id])
-            return false;
+    images.erase(asset_id);
+}
+
+template<typename T>
+T GameData::decode_asset(int id, std::string& error) const {
+    std::vector<uint8_t> buffer;
+
+    auto it = overrides.find(id);
+    if(it != overrides.end()) {
+        try {
+            buffer = readFile(it->second);
+            error = check_saved_hash(id, buffer);
+            return T(buffer);
+        } catch(std::exception& e) {
+            // fall back to the original asset. error is reported by the caller since this might run on a worker thread
+            error = std::format("Failed to load \"{}\": {}\nUsing original asset instead.", it->second, e.what());
+        }
     }
+    return T(get_asset(id, buffer));
+}
 
-    if(hash(uv_data::save(uvs)) != knownHashes[254])
-        return false;
+std::string GameData::check_saved_hash(int id, std::span<const uint8_t> data) const {
+    auto it = saved_hashes.find(id);
+    if(it == saved_hashes.end() || it->second == fast_hash(data)) return "";
+    return std::format("\"{}\" differs from the last save.\nIt was either modified outside the editor or the save was interrupted.", overrides.at(id));
+}
 
-    if(hash(uv_data::save(uvs)) != knownHashes[254])
-        return false;
+Map& GameData::decode_map(int index) const {
+    std::string error;
+    auto map = decode_asset<Map>(mapIds[index], error);
+    return store_map(index, std::move(map), error);
+}
 
-    return true;
+Image& GameData::decode_image(int asset_id) const {
+    std::string error;
+    auto image = decode_asset<Image>(asset_id, error);
+    return store_image(asset_id, std::move(image), error);
 }
 
-void GameData::bufferFromExe() {
-    for(size_t i = 0; i < 5; i++) {
-        auto dat = get_asset(mapIds[i]);
-        maps[i] = Map(dat);
-        assert(i == 4 || equal(dat, maps[i].save())); // map 4 has some random padding at the end
+Map& GameData::store_map(int index, Map&& map, const std::string& error) const {
+    if(!error.empty()) error_dialog.error(error);
+
+    // saving compares against the vanilla hash which is recorded by is_vanilla. for overrides that's the original map
+    std::optional<Map> original;
+    if(overrides.contains(mapIds[index])) {
+        std::vector<uint8_t> buffer;
+        original.emplace(get_asset(mapIds[index], buffer));
+        if(map.coordinate_map != original->coordinate_map) {
+            error_dialog.warning("Map structure differs from previously loaded map.\nMight break things so be careful.");
+        }
+    }
+    if(!is_vanilla((original ? *original : map).save(), mapIds[index]) && !hash_warning_shown) {
+        error_dialog.warning("Loaded exe differs from unmodified game files.");
+        hash_warning_shown = true;
     }
 
-    for(const auto [_, asset_id, tile_id] : spriteMapping) {
-        auto dat = get_asset(asset_id);
-        sprites[tile_id] = SpriteData(dat);
-        assert(equal(dat, sprites[tile_id].save()));
+    return maps[index].emplace(std::move(map));
+}
+
+Image& GameData::store_image(int asset_id, Image&& image, const std::string& error) const {
+    if(!error.empty()) error_dialog.error(error);
+    return images.insert_or_assign(asset_id, std::move(image)).first->second;
+}
+
+void GameData::preload(std::span<const int> asset_ids) const {
+    std::vector<int> ids;
+    for(auto id : asset_ids) {
+        auto map = std::find(std::begin(mapIds), std::end(mapIds), id);
+        bool loaded_ = map != std::end(mapIds) ? maps[map - mapIds].has_value() : images.contains(id);
+        if(!loaded_ && std::find(ids.begin(), ids.end(), id) == ids.end()) ids.push_back(id);
     }
 
-    uvs = uv_data::load(get_asset(254));
-    assert(equal(get_asset(254), uv_data::save(uvs)));
+    // decode on all cores, results are added to the cache in order afterwards
+    std::vector<std::variant<std::monostate, Map, Image>> results(ids.size());
+    std::vector<std::string> errors(ids.size());
+
+    parallel_for(ids.size(), [&](size_t i) {
+        if(std::find(std::begin(mapIds), std::end(mapIds), ids[i]) != std::end(mapIds)) {
+            results[i] = decode_asset<Map>(ids[i], errors[i]);
+        } else {
+            results[i] = decode_asset<Image>(ids[i], errors[i]);
+        }
+    });
+
+    for(size_t i = 0; i < ids.size(); i++) {
+        if(auto map = std::get_if<Map>(&results[i])) {
+            store_map(std::find(std::begin(mapIds), std::end(mapIds), ids[i]) - mapIds, std::move(*map), errors[i]);
+        } else {
+            store_image(ids[i], std::move(std::get<Image>(results[i])), errors[i]);
+        }
+    }
+}
+
+bool GameData::testAssetHashes() {
+    bool result = true;
 
-    ambient = LightingData::parse(get_asset(179));
-    assert(equal(get_asset(179), LightingData::save(ambient)));
+    // check everything so the hashes of all vanilla assets are known
+    for(const auto [_, asset_id, tile_id] : spriteMapping) {
+        result &= is_vanilla(sprites[tile_id].save(), asset_id);
+    }
+    result &= is_vanilla(uv_data::save(uvs), 254);
+    result &= is_vanilla(LightingData::save(ambient), 179);
 
-    atlas = Image(get_asset(255));
-    bunny = Image(get_asset(30));
-    time_capsule = Image(get_asset(277));
+    return result;
+}
 
-    for(size_t i = 11; i <= 24; i++) {
-        backgrounds[i - 11] = Image(get_asset(i));
+void GameData::bufferFromExe() {
+    std::vector<uint8_t> buffer;
+
+    overrides.clear();
+    saved_hashes.clear();
+    for(auto& map : maps) {
+        map.reset();
+    }
+    images.clear();
+
+    std::array<std::optional<SpriteData>, std::size(spriteMapping)> loaded_sprites;
+    parallel_for(loaded_sprites.size(), [&](size_t i) {
+        std::vector<uint8_t> buffer_;
+        auto dat = get_asset(spriteMapping[i].asset_id, buffer_);
+        auto& sprite = loaded_sprites[i].emplace(dat);
+        assert(equal<uint8_t>(dat, sprite.save()));
+    });
+    for(size_t i = 0; i < loaded_sprites.size(); i++) {
+        sprites[spriteMapping[i].tile_id] = std::move(*loaded_sprites[i]);
     }
-    // index 25 is skipped for some reason
-    backgrounds[14] = Image(get_asset(26));
+
+    auto uv_dat = get_asset(254, buffer);
+    uvs = uv_data::load(uv_dat);
+    assert(equal<uint8_t>(uv_dat, uv_data::save(uvs)));
+
+    auto ambient_dat = get_asset(179, buffer);
+    ambient = LightingData::parse(ambient_dat);
+    assert(equal<uint8_t>(ambient_dat, LightingData::save(ambient)));
 }
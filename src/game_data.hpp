@@ -1,8 +1,12 @@
 #pragma once
 #include <array>
+#include <atomic>
+#include <filesystem>
+#include <optional>
 #include <span>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "structures/ambient.hpp"
@@ -11,38 +15,141 @@
 #include "structures/sprite.hpp"
 #include "structures/tile.hpp"
 
-#include "image.hpp"
 #include "dos_parser.hpp"
+#include "image.hpp"
+#include "mapped_file.hpp"
 
 constexpr const char* mapNames[5] = {"Overworld", "CE temple", "Space", "Bunny temple", "Time Capsule"};
 constexpr int mapIds[5] = {300, 157, 193, 52, 222};
 
+// copy of everything a save writes. it doesn't reference GameData so it can be written on a worker thread while editing continues
+struct SaveSnapshot {
+    struct File {
+        int asset_id;
+        std::string name;
+        std::vector<uint8_t> data;
+        // images are copied and only encoded to png while writing since that's the slowest part
+        std::optional<Image> image;
+        // fast_hash of the vanilla asset if it's already known
+        std::optional<uint64_t> vanilla_hash;
+    };
+
+    std::string path;
+    std::string previous_project_path;
+    std::vector<File> files;
+};
+
 class GameData {
   private:
-    std::vector<uint8_t> raw;
+    MappedFile exe;
     SegmentData sections;
 
+    // asset id -> file in the project folder that replaces the asset from the exe
+    std::unordered_map<int, std::string> overrides;
+
+    // maps and images are only decoded on first access
+    mutable std::array<std::optional<Map>, 5> maps;
+    mutable std::unordered_map<int, Image> images;
+    mutable bool hash_warning_shown = false;
+
+    // asset id -> fast_hash of the override file according to the manifest written by the last save
+    std::unordered_map<int, uint64_t> saved_hashes;
+
+    // asset id -> fast_hash of the vanilla asset. filled in once data was verified against the known hashes
+    mutable std::unordered_map<int, uint64_t> vanilla_hashes;
+
+    // assets that were modified since they were last loaded from/saved to project_path
+    std::unordered_set<int> dirty;
+    std::string project_path;
+    std::string exe_path;
+    std::array<uint32_t, 5> map_versions {};
+
   public:
     std::span<const asset_entry> assets;
 
-    std::array<Map, 5> maps {};
     std::unordered_map<uint32_t, SpriteData> sprites;
     std::vector<uv_data> uvs;
     std::vector<LightingData> ambient;
 
-    Image atlas, bunny, time_capsule;
-    std::array<Image, 15> backgrounds;
-
     bool loaded = false;
 
+    Map& map(int index);
+    const Map& map(int index) const;
+    bool map_loaded(int index) const { return maps[index].has_value(); }
+
+    // png assets (atlas, bunny, time capsule, backgrounds)
+    Image& image(int asset_id);
+    const Image& image(int asset_id) const;
+
+    Image& atlas() { return image(255); }
+    const Image& atlas() const { return image(255); }
+    const Image& bunny() const { return image(30); }
+    const Image& time_capsule() const { return image(277); }
+    // index 0-14 into the background images
+    const Image& background(int index) const { return image(background_id(index)); }
+    static constexpr int background_id(int index) { return index < 14 ? 11 + index : 26; }
+
+    // decode multiple maps/images in parallel so they don't have to be decoded one by one on first access
+    void preload(std::span<const int> asset_ids) const;
+
+    // drop the decoded asset. the next access decodes it again from the exe or project folder
+    void invalidate(int asset_id);
+
     static GameData load_exe(const std::string& path);
     void load_folder(const std::string& path);
-    void save_folder(const std::string& path) const;
+    // only writes modified assets unless path is a different folder than the one last loaded/saved
+    void save_folder(const std::string& path);
+
+    // save_folder split in two. snapshot is cheap and has to run on the ui thread, write_snapshot can run anywhere.
+    // progress is incremented for every file written
+    SaveSnapshot snapshot(const std::string& path);
+    static void write_snapshot(const SaveSnapshot& snapshot, std::atomic<size_t>& progress);
+    // marks the assets of a failed save dirty again so the next save retries them
+    void save_failed(const SaveSnapshot& snapshot);
 
-    std::vector<uint8_t> get_asset(int id);
+    // writes a copy of the loaded exe with all edits packed into it.
+    // assets that grew are moved into a new section at the end of the exe
+    void save_exe(const std::string& path) const;
+
+    // backups made by saving into a project folder, oldest first
+    static std::vector<std::string> list_backups(const std::string& path);
+    // replaces the asset files in path with the backup. the folder has to be loaded again afterwards
+    static void restore_backup(const std::string& path, const std::string& name);
+
+    // has to be called for every edit so the asset gets saved
+    void mark_dirty(int asset_id) { dirty.insert(asset_id); }
+    void mark_map_dirty(int index) {
+        mark_dirty(mapIds[index]);
+        map_versions[index]++;
+    }
+    void mark_sprite_dirty(int tile_id);
+    bool is_dirty(int asset_id) const { return dirty.contains(asset_id); }
+    // incremented by mark_map_dirty so edits can be noticed without comparing the whole map
+    uint32_t map_version(int index) const { return map_versions[index]; }
+
+    // folder the data was last loaded from/saved to. empty if only the exe is loaded
+    const std::string& get_project_path() const { return project_path; }
+    // absolute path of the loaded exe
+    const std::string& get_exe_path() const { return exe_path; }
+
+    // copy of the (decrypted) asset data
+    std::vector<uint8_t> get_asset(int id) const;
+    // points directly into the exe unless the asset has to be decrypted into buffer
+    std::span<const uint8_t> get_asset(int id, std::vector<uint8_t>& buffer) const;
 
   private:
-    void backup_assets(const std::string& path) const;
+    template<typename T>
+    T decode_asset(int id, std::string& error) const;
+    // error message if data doesn't match the hash from the manifest
+    std::string check_saved_hash(int id, std::span<const uint8_t> data) const;
+    Map& decode_map(int index) const;
+    Image& decode_image(int asset_id) const;
+    Map& store_map(int index, Map&& map, const std::string& error) const;
+    Image& store_image(int asset_id, Image&& image, const std::string& error) const;
+
+    bool is_vanilla(std::span<const uint8_t> data, int assetId) const;
+    // always makes a new backup unless the last one has the same content, otherwise at most one per minute
+    static void backup_assets(const std::string& path, bool always = false);
 
     bool testAssetHashes();
     void bufferFromExe();
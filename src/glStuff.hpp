@@ -1,8 +1,14 @@
 #pragma once
 
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
 #include <fstream>
 #include <span>
 #include <string>
+#include <vector>
 
 #include <glad/gl.h>
 #include <glm/glm.hpp>
@@ -75,6 +81,43 @@ struct VBO {
         glBindBuffer(target, id);
         glBufferData(target, dataSize, data, usage);
     }
+    void BufferSubData(int offset, const void* data, int dataSize) {
+        glBindBuffer(target, id);
+        glBufferSubData(target, offset, dataSize, data);
+    }
+
+    // for data that changes every frame. appends behind everything written since the storage was last
+    // orphaned so draws still reading older data never have to finish first. returns the index of the first element
+    size_t Stream(const void* data, size_t count, size_t stride) {
+        glBindBuffer(target, id);
+
+        auto size = count * stride;
+        auto start = (cursor + stride - 1) / stride * stride;
+        if(start + size > capacity) {
+            // the driver keeps the old storage alive until the draws using it are done
+            if(size * 4 > capacity) capacity = std::max<size_t>(std::bit_ceil(size * 4), 64 * 1024);
+            glBufferData(target, capacity, nullptr, usage);
+            start = 0;
+        }
+        cursor = start + size;
+        if(size == 0) return 0;
+
+#ifndef __EMSCRIPTEN__
+        // webgl can't map buffers
+        auto ptr = glMapBufferRange(target, start, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        if(ptr != nullptr) {
+            std::memcpy(ptr, data, size);
+            if(glUnmapBuffer(target) == GL_TRUE) return start / stride;
+        }
+#endif
+        glBufferSubData(target, start, size, data);
+        return start / stride;
+    }
+
+  private:
+    // used by Stream
+    size_t capacity = 0;
+    size_t cursor = 0;
 };
 
 struct Texture {
@@ -290,13 +333,65 @@ struct Vertex {
     Vertex(glm::vec2 position, glm::vec2 uv) : position(position), uv(uv), color(IM_COL32_WHITE) {}
 };
 
+// one quad of map geometry, drawn as an instance and expanded to 4 vertices by tile.vs.
+// position in pixels relative to the map origin, uvs in texels
+struct TileQuad {
+    enum Flags : uint8_t {
+        mirror_x = 1,
+        mirror_y = 2,
+        transpose = 4, // swaps the uv axes. combined with mirroring this gives all rotations
+    };
+
+    glm::i16vec2 position;
+    glm::u16vec2 size;
+    glm::u16vec2 uv;      // top left of the source rect
+    glm::u16vec2 uv_size; // size of the source rect before transposing
+    uint32_t color = IM_COL32_WHITE;
+    uint8_t flags = 0;
+
+    TileQuad() = default;
+
+    // quad whose corner (x, y) in [0, 1] samples uv + x * right + y * down. right and down have to be axis aligned
+    TileQuad(glm::ivec2 position, glm::ivec2 size, glm::ivec2 uv, glm::ivec2 right, glm::ivec2 down, uint32_t color = IM_COL32_WHITE) : position(position), size(size), color(color) {
+        this->uv = glm::min(glm::min(uv, uv + right), glm::min(uv + down, uv + right + down));
+
+        if(right.x != 0 || down.y != 0) {
+            uv_size = glm::abs(glm::ivec2(right.x, down.y));
+            if(right.x < 0) flags |= mirror_x;
+            if(down.y < 0) flags |= mirror_y;
+        } else {
+            uv_size = glm::abs(glm::ivec2(down.x, right.y));
+            flags |= transpose;
+            if(down.x < 0) flags |= mirror_x;
+            if(right.y < 0) flags |= mirror_y;
+        }
+    }
+};
+static_assert(sizeof(TileQuad) == 24);
+
+// uv_max may be smaller than uv_min to mirror
+inline void AddRectFilled(std::vector<TileQuad>& data, glm::ivec2 p_min, glm::ivec2 p_max, glm::ivec2 uv_min, glm::ivec2 uv_max, uint32_t col = IM_COL32_WHITE) {
+    data.emplace_back(p_min, p_max - p_min, uv_min, glm::ivec2(uv_max.x - uv_min.x, 0), glm::ivec2(0, uv_max.y - uv_min.y), col);
+}
+
+inline void AddRectFilled(std::vector<Vertex>& data, glm::vec2 p_min, glm::vec2 p_max, glm::vec2 uv_min, glm::vec2 uv_max, uint32_t col = IM_COL32_WHITE) {
+    data.emplace_back(p_min, uv_min, col); // tl
+    data.emplace_back(glm::vec2(p_max.x, p_min.y), glm::vec2(uv_max.x, uv_min.y), col); // tr
+    data.emplace_back(glm::vec2(p_min.x, p_max.y), glm::vec2(uv_min.x, uv_max.y), col); // bl
+
+    data.emplace_back(glm::vec2(p_max.x, p_min.y), glm::vec2(uv_max.x, uv_min.y), col); // tr
+    data.emplace_back(p_max, uv_max, col); // br
+    data.emplace_back(glm::vec2(p_min.x, p_max.y), glm::vec2(uv_min.x, uv_max.y), col); // bl
+}
+
 struct Mesh {
     VAO vao;
-    VBO vbo {GL_ARRAY_BUFFER, GL_STATIC_DRAW};
+    VBO vbo;
 
     std::vector<Vertex> data;
 
-    Mesh() {
+    // GL_STREAM_DRAW for meshes that are rebuilt every frame
+    explicit Mesh(GLenum usage = GL_STATIC_DRAW) : vbo(GL_ARRAY_BUFFER, usage) {
         vao.Bind();
         vbo.Bind();
 
@@ -308,16 +403,134 @@ struct Mesh {
         glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vertex), (void*)(4 * sizeof(float)));
     }
 
-    void AddLine(glm::vec2 p1, glm::vec2 p2, uint32_t col = IM_COL32_WHITE, float thickness = 1) {
-        auto d = glm::normalize(p2 - p1) * (thickness * 0.5f);
+    void AddRectFilled(glm::vec2 p_min, glm::vec2 p_max, glm::vec2 uv_min, glm::vec2 uv_max, uint32_t col = IM_COL32_WHITE) {
+        ::AddRectFilled(data, p_min, p_max, uv_min, uv_max, col);
+    }
 
-        data.emplace_back(glm::vec2(p1.x + d.y, p1.y - d.x), glm::vec2(), col); // tl
-        data.emplace_back(glm::vec2(p2.x + d.y, p2.y - d.x), glm::vec2(), col); // tr
-        data.emplace_back(glm::vec2(p1.x - d.y, p1.y + d.x), glm::vec2(), col); // bl
+    void Buffer() {
+        if(vbo.usage == GL_STREAM_DRAW) {
+            first = vbo.Stream(data.data(), data.size(), sizeof(Vertex));
+        } else {
+            first = 0;
+            vbo.BufferData(data.data(), data.size() * sizeof(Vertex));
+        }
+    }
+    void Draw() {
+        vao.Bind();
+        glDrawArrays(GL_TRIANGLES, first, data.size());
+    }
+    void clear() {
+        data.clear();
+    }
+
+  private:
+    size_t first = 0;
+};
 
-        data.emplace_back(glm::vec2(p2.x - d.y, p2.y + d.x), glm::vec2(), col); // br
-        data.emplace_back(glm::vec2(p1.x - d.y, p1.y + d.x), glm::vec2(), col); // bl
-        data.emplace_back(glm::vec2(p2.x + d.y, p2.y - d.x), glm::vec2(), col); // tr
+// functions newer than the generated loader which only goes up to GL 3.2
+namespace gl_ext {
+    using VertexAttribDivisorProc = void(GLAD_API_PTR*)(GLuint index, GLuint divisor);
+    inline VertexAttribDivisorProc VertexAttribDivisor = nullptr;
+
+    // has to be called after gladLoadGL. returns false if instancing isn't supported
+    inline bool load(GLADloadfunc load) {
+        VertexAttribDivisor = (VertexAttribDivisorProc)load("glVertexAttribDivisor");
+        if(VertexAttribDivisor == nullptr) VertexAttribDivisor = (VertexAttribDivisorProc)load("glVertexAttribDivisorARB");
+        return VertexAttribDivisor != nullptr;
+    }
+} // namespace gl_ext
+
+// instanced mesh of TileQuad. has to be drawn with tile.vs
+struct TileMesh {
+    VAO vao;
+    VBO vbo {GL_ARRAY_BUFFER, GL_STATIC_DRAW};
+
+    std::vector<TileQuad> data;
+
+    TileMesh() {
+        vao.Bind();
+        vbo.Bind();
+
+        for(int i = 0; i <= 5; i++) {
+            glEnableVertexAttribArray(i);
+            gl_ext::VertexAttribDivisor(i, 1);
+        }
+        set_base(0);
+    }
+
+    void AddRectFilled(glm::ivec2 p_min, glm::ivec2 p_max, glm::ivec2 uv_min, glm::ivec2 uv_max, uint32_t col = IM_COL32_WHITE) {
+        ::AddRectFilled(data, p_min, p_max, uv_min, uv_max, col);
+    }
+
+    void Buffer() {
+        vbo.BufferData(data.data(), data.size() * sizeof(TileQuad));
+    }
+    void Draw() {
+        Draw(0, data.size());
+    }
+    // draws quads [first, first + count)
+    void Draw(size_t first, size_t count) {
+        if(count == 0) return;
+        vao.Bind();
+        // instanced draws have no base instance before GL 4.2 so the attributes are moved instead
+        if(first != base) {
+            vbo.Bind();
+            set_base(first);
+        }
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, count);
+    }
+    void clear() {
+        data.clear();
+    }
+
+  private:
+    size_t base = 0;
+
+    // vao and vbo have to be bound
+    void set_base(size_t first) {
+        auto offset = [&](size_t member) { return (void*)(first * sizeof(TileQuad) + member); };
+
+        glVertexAttribPointer(0, 2, GL_SHORT, GL_FALSE, sizeof(TileQuad), offset(offsetof(TileQuad, position)));
+        glVertexAttribPointer(1, 2, GL_UNSIGNED_SHORT, GL_FALSE, sizeof(TileQuad), offset(offsetof(TileQuad, size)));
+        glVertexAttribPointer(2, 2, GL_UNSIGNED_SHORT, GL_FALSE, sizeof(TileQuad), offset(offsetof(TileQuad, uv)));
+        glVertexAttribPointer(3, 2, GL_UNSIGNED_SHORT, GL_FALSE, sizeof(TileQuad), offset(offsetof(TileQuad, uv_size)));
+        glVertexAttribPointer(4, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(TileQuad), offset(offsetof(TileQuad, color)));
+        glVertexAttribIPointer(5, 1, GL_UNSIGNED_BYTE, sizeof(TileQuad), offset(offsetof(TileQuad, flags)));
+        base = first;
+    }
+};
+
+// line segment with thickness, drawn as an instance and expanded to a quad by line.vs
+struct LineInstance {
+    glm::vec2 start;
+    glm::vec2 end;
+    float thickness;
+    uint32_t color;
+};
+static_assert(sizeof(LineInstance) == 24);
+
+// instanced lines and filled rectangles for overlays. has to be drawn with line.vs
+struct LineMesh {
+    VAO vao;
+    VBO vbo;
+
+    std::vector<LineInstance> data;
+
+    // GL_STREAM_DRAW for meshes that are rebuilt every frame
+    explicit LineMesh(GLenum usage = GL_STATIC_DRAW) : vbo(GL_ARRAY_BUFFER, usage) {
+        vao.Bind();
+        vbo.Bind();
+
+        for(int i = 0; i <= 3; i++) {
+            glEnableVertexAttribArray(i);
+            gl_ext::VertexAttribDivisor(i, 1);
+        }
+        set_base(0);
+    }
+
+    void AddLine(glm::vec2 p1, glm::vec2 p2, uint32_t col = IM_COL32_WHITE, float thickness = 1) {
+        if(p1 == p2) return;
+        data.push_back({p1, p2, thickness, col});
     }
 
     void AddLineDashed(glm::vec2 p1, glm::vec2 p2, uint32_t col = IM_COL32_WHITE, float thickness = 1, float dashLength = 1) {
@@ -342,14 +555,11 @@ struct Mesh {
         AddLine(p_max, glm::vec2(p_min.x, p_max.y), col, thickness);
         AddLine(glm::vec2(p_min.x, p_max.y), p_min, col, thickness);
     }
-    void AddRectFilled(glm::vec2 p_min, glm::vec2 p_max, glm::vec2 uv_min, glm::vec2 uv_max, uint32_t col = IM_COL32_WHITE) {
-        data.emplace_back(p_min, uv_min, col); // tl
-        data.emplace_back(glm::vec2(p_max.x, p_min.y), glm::vec2(uv_max.x, uv_min.y), col); // tr
-        data.emplace_back(glm::vec2(p_min.x, p_max.y), glm::vec2(uv_min.x, uv_max.y), col); // bl
 
-        data.emplace_back(glm::vec2(p_max.x, p_min.y), glm::vec2(uv_max.x, uv_min.y), col); // tr
-        data.emplace_back(p_max, uv_max, col); // br
-        data.emplace_back(glm::vec2(p_min.x, p_max.y), glm::vec2(uv_min.x, uv_max.y), col); // bl
+    // a horizontal line as thick as the rect is high
+    void AddRectFilled(glm::vec2 p_min, glm::vec2 p_max, uint32_t col = IM_COL32_WHITE) {
+        auto y = (p_min.y + p_max.y) / 2;
+        AddLine({p_min.x, y}, {p_max.x, y}, col, std::abs(p_max.y - p_min.y));
     }
 
     void AddRectDashed(glm::vec2 p_min, glm::vec2 p_max, uint32_t col = IM_COL32_WHITE, float thickness = 1, float dashLength = 1) {
@@ -360,13 +570,38 @@ struct Mesh {
     }
 
     void Buffer() {
-        vbo.BufferData(data.data(), data.size() * sizeof(Vertex));
+        if(vbo.usage == GL_STREAM_DRAW) {
+            first = vbo.Stream(data.data(), data.size(), sizeof(LineInstance));
+        } else {
+            first = 0;
+            vbo.BufferData(data.data(), data.size() * sizeof(LineInstance));
+        }
     }
     void Draw() {
+        if(data.empty()) return;
         vao.Bind();
-        glDrawArrays(GL_TRIANGLES, 0, data.size());
+        if(first != base) {
+            vbo.Bind();
+            set_base(first);
+        }
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, data.size());
     }
     void clear() {
         data.clear();
     }
+
+  private:
+    size_t first = 0;
+    size_t base = 0;
+
+    // vao and vbo have to be bound
+    void set_base(size_t first) {
+        auto offset = [&](size_t member) { return (void*)(first * sizeof(LineInstance) + member); };
+
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(LineInstance), offset(offsetof(LineInstance, start)));
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(LineInstance), offset(offsetof(LineInstance, end)));
+        glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, sizeof(LineInstance), offset(offsetof(LineInstance, thickness)));
+        glVertexAttribPointer(3, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(LineInstance), offset(offsetof(LineInstance, color)));
+        base = first;
+    }
 };
@@ -14,6 +14,5 @@ inline uint8_t mode1_layer = 0;
 inline MapSlice clipboard;
 
 inline Map& currentMap() {
-    assert(selectedMap >= 0 && selectedMap < game_data.maps.size());
-    return game_data.maps[selectedMap];
+    return game_data.map(selectedMap);
 }
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <span>
+
+// xxHash64 (https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md)
+// processes 32 bytes per step in 4 independent lanes so it isn't limited by multiply latency like fnv
+namespace xxh64 {
+    constexpr uint64_t prime1 = 0x9E3779B185EBCA87ull;
+    constexpr uint64_t prime2 = 0xC2B2AE3D27D4EB4Full;
+    constexpr uint64_t prime3 = 0x165667B19E3779F9ull;
+    constexpr uint64_t prime4 = 0x85EBCA77C2B2AE63ull;
+    constexpr uint64_t prime5 = 0x27D4EB2F165667C5ull;
+
+    inline uint64_t rotl(uint64_t x, int r) {
+        return (x << r) | (x >> (64 - r));
+    }
+    inline uint64_t read64(const uint8_t* ptr) {
+        uint64_t val;
+        std::memcpy(&val, ptr, 8);
+        return val;
+    }
+    inline uint32_t read32(const uint8_t* ptr) {
+        uint32_t val;
+        std::memcpy(&val, ptr, 4);
+        return val;
+    }
+
+    inline uint64_t round(uint64_t acc, uint64_t input) {
+        acc += input * prime2;
+        acc = rotl(acc, 31);
+        return acc * prime1;
+    }
+    inline uint64_t merge_round(uint64_t acc, uint64_t val) {
+        acc ^= round(0, val);
+        return acc * prime1 + prime4;
+    }
+} // namespace xxh64
+
+inline uint64_t fast_hash(std::span<const uint8_t> data, uint64_t seed = 0) {
+    using namespace xxh64;
+
+    auto ptr = data.data();
+    auto end = ptr + data.size();
+    uint64_t h;
+
+    if(data.size() >= 32) {
+        uint64_t v1 = seed + prime1 + prime2;
+        uint64_t v2 = seed + prime2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - prime1;
+
+        for(; ptr + 32 <= end; ptr += 32) {
+            v1 = round(v1, read64(ptr));
+            v2 = round(v2, read64(ptr + 8));
+            v3 = round(v3, read64(ptr + 16));
+            v4 = round(v4, read64(ptr + 24));
+        }
+
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = merge_round(h, v1);
+        h = merge_round(h, v2);
+        h = merge_round(h, v3);
+        h = merge_round(h, v4);
+    } else {
+        h = seed + prime5;
+    }
+
+    h += data.size();
+
+    for(; ptr + 8 <= end; ptr += 8) {
+        h ^= round(0, read64(ptr));
+        h = rotl(h, 27) * prime1 + prime4;
+    }
+    if(ptr + 4 <= end) {
+        h ^= read32(ptr) * prime1;
+        h = rotl(h, 23) * prime2 + prime3;
+        ptr += 4;
+    }
+    for(; ptr < end; ptr++) {
+        h ^= *ptr * prime5;
+        h = rotl(h, 11) * prime1;
+    }
+
+    h ^= h >> 33;
+    h *= prime2;
+    h ^= h >> 29;
+    h *= prime3;
+    h ^= h >> 32;
+    return h;
+}
@@ -1,4 +1,8 @@
 #include "history.hpp"
+
+#include <algorithm>
+
+#include "delta.hpp"
 #include "selection.hpp"
 #include "globals.hpp"
 
@@ -9,46 +13,204 @@ static void highlightArea(glm::ivec3 start, glm::ivec2 size) {
     selection_handler.drag_end(glm::ivec2(start) + size - 1);
 }
 
+static std::span<uint8_t> as_bytes(std::span<MapTile> tiles) {
+    return {(uint8_t*)tiles.data(), tiles.size_bytes()};
+}
+
+AreaDelta::AreaDelta(glm::ivec3 pos, const MapSlice& tiles) : pos(pos), size(tiles.size()) {
+    auto t = tiles.tiles();
+    data = xor_rle::encode({(const uint8_t*)t.data(), t.size_bytes()});
+}
+
+void AreaDelta::apply(Map& map) {
+    MapSlice tiles;
+    tiles.fill({}, size);
+    xor_rle::apply(as_bytes(tiles.tiles()), data);
+
+    if(is_delta) {
+        map.for_each_row(pos.z, pos, size, [&](glm::ivec2 p, std::span<MapTile> row) {
+            auto src = as_bytes(tiles.tiles()).subspan(((p.x - pos.x) + (p.y - pos.y) * size.x) * sizeof(MapTile), row.size_bytes());
+            auto dst = as_bytes(row);
+            for(size_t i = 0; i < dst.size(); i++) {
+                dst[i] ^= src[i];
+            }
+        });
+        return;
+    }
+
+    auto after = tiles;
+    tiles.swap(map, pos);
+    // tiles now holds what was in the map before
+    auto before = tiles.tiles();
+    auto after_ = after.tiles();
+    data = xor_rle::encode({(const uint8_t*)before.data(), before.size_bytes()}, {(const uint8_t*)after_.data(), after_.size_bytes()});
+    data.shrink_to_fit();
+    is_delta = true;
+}
+
 void AreaMove::apply() {
     auto& map = currentMap();
+    game_data.mark_map_dirty(selectedMap);
 
-    dest_data.swap(map, dest);
-    src_data.swap(map, src);
+    // once both are deltas the order doesn't matter anymore
+    dest_data.apply(map);
+    src_data.apply(map);
 
-    std::swap(src_data, dest_data);
     std::swap(src, dest);
 
-    highlightArea(dest, dest_data.size());
+    highlightArea(dest, size);
 }
 
 void AreaChange::apply() {
-    tiles.swap(currentMap(), position);
-    highlightArea(position, tiles.size());
+    tiles.apply(currentMap());
+    game_data.mark_map_dirty(selectedMap);
+    highlightArea(position, size);
 }
 
-void SingleChange::apply() {
+bool AreaMove::continues(const HistoryItem& next) const {
+    auto move = dynamic_cast<const AreaMove*>(&next);
+    // the same block picked up again where it was dropped
+    return move != nullptr && move->src == dest && move->size == size;
+}
+
+void TileChange::apply() {
     auto& map = currentMap();
 
-    auto t = map.getTile(position.z, position.x, position.y);
-    map.setTile(position.z, position.x, position.y, tile);
-    tile = t.value();
+    glm::ivec2 min = tiles[0].first, max = tiles[0].first;
+    for(auto& [pos, tile] : tiles) {
+        auto t = map.getTile(layer, pos.x, pos.y);
+        map.setTile(layer, pos.x, pos.y, tile);
+        tile = t.value();
+
+        min = glm::min(min, pos);
+        max = glm::max(max, pos);
+    }
+    game_data.mark_map_dirty(selectedMap);
+
+    highlightArea(glm::ivec3(min, layer), max - min + 1);
+}
+
+bool TileChange::merge(const HistoryItem& next) {
+    auto change = dynamic_cast<const TileChange*>(&next);
+    if(change == nullptr || change->layer != layer) return false;
+
+    // only merge tiles that continue the stroke
+    auto [pos, tile] = change->tiles[0];
+    auto delta = glm::abs(pos - tiles.back().first);
+    if(delta.x > 4 || delta.y > 4) return false;
+
+    // keep the oldest tile so undo restores the state before the stroke
+    auto it = std::find_if(tiles.begin(), tiles.end(), [&](auto& el) { return el.first == pos; });
+    if(it == tiles.end()) {
+        tiles.emplace_back(pos, tile);
+    } else {
+        // move to the back so the stroke continues from here
+        std::rotate(it, it + 1, tiles.end());
+    }
+    return true;
+}
+
+HistoryGroup::HistoryGroup(std::unique_ptr<HistoryItem> first, std::unique_ptr<HistoryItem> second) {
+    items.push_back(std::move(first));
+    items.push_back(std::move(second));
+}
 
-    highlightArea(position, {1, 1});
+void HistoryGroup::apply() {
+    if(reverse) {
+        for(auto it = items.rbegin(); it != items.rend(); ++it) (*it)->apply();
+    } else {
+        for(auto& item : items) item->apply();
+    }
+    reverse = !reverse;
 }
 
-void MapClear::apply() {
-    std::swap(currentMap().rooms, rooms);
+size_t HistoryGroup::memory_usage() const {
+    size_t total = sizeof(*this) + items.capacity() * sizeof(items[0]);
+    for(auto& item : items) {
+        total += item->memory_usage();
+    }
+    return total;
+}
+
+MapChange::MapChange(int map_index, const std::vector<Room>& before, const std::vector<Room>& after) : map_index(map_index) {
+    assert(before.size() == after.size());
+
+    // the delta only covers tiles. headers are taken from before so they xor to zero and apply leaves them to the swap
+    auto tiles_only = after;
+    properties.resize(before.size());
+    for(size_t i = 0; i < before.size(); i++) {
+        std::memcpy(properties[i].data(), &before[i], properties[i].size());
+        std::memcpy((uint8_t*)&tiles_only[i], &before[i], properties[i].size());
+    }
+    delta = xor_rle::encode({(const uint8_t*)before.data(), before.size() * sizeof(Room)}, {(const uint8_t*)tiles_only.data(), tiles_only.size() * sizeof(Room)});
+}
+
+void MapChange::apply() {
+    auto& rooms = game_data.map(map_index).rooms;
+    xor_rle::apply({(uint8_t*)rooms.data(), rooms.size() * sizeof(Room)}, delta);
+
+    // properties might have been edited in the meantime so they're swapped instead
+    for(size_t i = 0; i < rooms.size(); i++) {
+        std::array<uint8_t, offsetof(Room, tiles)> current;
+        std::memcpy(current.data(), &rooms[i], current.size());
+        std::memcpy((uint8_t*)&rooms[i], properties[i].data(), current.size());
+        properties[i] = current;
+    }
+    game_data.mark_map_dirty(map_index);
+    // room properties like the background are part of the geometry too
+    updateGeometry = true;
 }
 
 void SwitchLayer::apply() {
     std::swap(selectedMap, from);
+    updateGeometry = true;
 }
 
 void HistoryManager::push_action(std::unique_ptr<HistoryItem> item) {
+    auto now = std::chrono::steady_clock::now();
+    bool recent = !undo_buffer.empty() && redo_buffer.empty() && now - last_push <= coalesce_window;
+    last_push = now;
+    redo_buffer.clear();
+
+    if(recent) {
+        auto& prev = undo_buffer.back();
+        if(prev->merge(*item)) {
+            trim();
+            return;
+        }
+        if(prev->continues(*item)) {
+            if(auto group = dynamic_cast<HistoryGroup*>(prev.get())) {
+                group->add(std::move(item));
+            } else {
+                prev = std::make_unique<HistoryGroup>(std::move(prev), std::move(item));
+            }
+            trim();
+            return;
+        }
+    }
+
     undo_buffer.push_back(std::move(item));
-    if(undo_buffer.size() > max_undo_size)
+    trim();
+}
+
+size_t HistoryManager::memory_usage() const {
+    size_t total = 0;
+    for(auto& item : undo_buffer) {
+        total += item->memory_usage();
+    }
+    for(auto& item : redo_buffer) {
+        total += item->memory_usage();
+    }
+    return total;
+}
+
+void HistoryManager::trim() {
+    auto usage = memory_usage();
+    // the most recent action is always kept
+    while(usage > memory_budget && undo_buffer.size() > 1) {
+        usage -= undo_buffer.front()->memory_usage();
         undo_buffer.pop_front();
-    redo_buffer.clear();
+    }
 }
 
 // undo most recent item
@@ -59,9 +221,10 @@ void HistoryManager::undo() {
     auto el = std::move(undo_buffer.back());
     undo_buffer.pop_back();
 
+    // items mark the rooms they touched for the renderer
     el->apply();
-    updateGeometry = true;
     redo_buffer.push_back(std::move(el));
+    trim();
 }
 void HistoryManager::redo() {
     if(redo_buffer.empty()) return;
@@ -71,8 +234,8 @@ void HistoryManager::redo() {
     redo_buffer.pop_back();
 
     el->apply();
-    updateGeometry = true;
     undo_buffer.push_back(std::move(el));
+    trim();
 }
 void HistoryManager::clear() {
     undo_buffer.clear();
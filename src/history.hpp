@@ -3,6 +3,9 @@
 #include "map_slice.hpp"
 #include <glm/glm.hpp>
 
+#include <array>
+#include <chrono>
+#include <cstddef>
 #include <deque>
 #include <memory>
 #include <vector>
@@ -14,48 +17,103 @@ class HistoryItem {
     // apply changes to map and invert state, so that it can be redone
     // returns position and size of changed area
     virtual void apply() = 0;
+
+    // heap + object size in bytes. can change when applied
+    virtual size_t memory_usage() const = 0;
+
+    // absorbs next into this item if both can be stored as one change (e.g. tiles of the same brush stroke)
+    virtual bool merge(const HistoryItem&) { return false; }
+    // whether next continues this action (e.g. moving the same selection again) so both are undone together
+    virtual bool continues(const HistoryItem&) const { return false; }
+};
+
+// tiles of an area that get swapped with the map, stored as xor/rle.
+// the first apply replaces them with the xor of the map before and after which is usually much smaller
+// and only needs to be xored into the map after that
+class AreaDelta {
+    glm::ivec3 pos;
+    glm::ivec2 size;
+    std::vector<uint8_t> data;
+    bool is_delta = false;
+
+  public:
+    AreaDelta(glm::ivec3 pos, const MapSlice& tiles);
+
+    void apply(Map& map);
+    size_t memory_usage() const { return data.capacity(); }
 };
 
 class AreaMove final : public HistoryItem {
     glm::ivec3 dest;
     glm::ivec3 src;
+    glm::ivec2 size;
 
-    MapSlice dest_data;
-    MapSlice src_data;
+    AreaDelta dest_data;
+    AreaDelta src_data;
 
   public:
-    AreaMove(glm::ivec3 dest, glm::ivec3 src, MapSlice dest_data, MapSlice src_data) : dest(dest), src(src), dest_data(std::move(dest_data)), src_data(std::move(src_data)) {}
+    AreaMove(glm::ivec3 dest, glm::ivec3 src, const MapSlice& dest_data, const MapSlice& src_data) : dest(dest), src(src), size(dest_data.size()), dest_data(dest, dest_data), src_data(src, src_data) {}
 
     void apply() override;
+    size_t memory_usage() const override { return sizeof(*this) + dest_data.memory_usage() + src_data.memory_usage(); }
+    bool continues(const HistoryItem& next) const override;
 };
 
 class AreaChange final : public HistoryItem {
     glm::ivec3 position;
-    MapSlice tiles;
+    glm::ivec2 size;
+    AreaDelta tiles;
 
   public:
-    AreaChange(glm::ivec3 position, MapSlice tiles) : position(position), tiles(std::move(tiles)) {}
+    AreaChange(glm::ivec3 position, const MapSlice& tiles) : position(position), size(tiles.size()), tiles(position, tiles) {}
 
     void apply() override;
+    size_t memory_usage() const override { return sizeof(*this) + tiles.memory_usage(); }
 };
 
-class SingleChange final : public HistoryItem {
-    glm::ivec3 position;
-    MapTile tile;
+// single tiles placed by hand. consecutive placements close to each other are merged into one stroke
+class TileChange final : public HistoryItem {
+    int layer;
+    // position and the tile that was there before the stroke. every position appears once
+    std::vector<std::pair<glm::ivec2, MapTile>> tiles;
+
+  public:
+    TileChange(glm::ivec3 position, MapTile tile) : layer(position.z), tiles {{glm::ivec2(position), tile}} {}
+
+    void apply() override;
+    size_t memory_usage() const override { return sizeof(*this) + tiles.capacity() * sizeof(tiles[0]); }
+    bool merge(const HistoryItem& next) override;
+};
+
+// change to all rooms of a map (clear, randomize)
+class MapChange final : public HistoryItem {
+    int map_index;
+    // room properties are swapped, tiles are stored as xor of the two states
+    std::vector<std::array<uint8_t, offsetof(Room, tiles)>> properties;
+    std::vector<uint8_t> delta;
 
   public:
-    SingleChange(glm::ivec3 position, MapTile tile) : position(position), tile(tile) {}
+    // has to be pushed after the map was changed
+    MapChange(int map_index, const std::vector<Room>& before, const std::vector<Room>& after);
 
     void apply() override;
+    size_t memory_usage() const override { return sizeof(*this) + properties.capacity() * sizeof(properties[0]) + delta.capacity(); }
 };
 
-class MapClear final : public HistoryItem {
-    std::vector<Room> rooms;
+// actions that are undone/redone as one step
+class HistoryGroup final : public HistoryItem {
+    std::vector<std::unique_ptr<HistoryItem>> items;
+    // undo has to go back to front, redo front to back
+    bool reverse = true;
 
   public:
-    MapClear(std::vector<Room> rooms) : rooms(std::move(rooms)) {}
+    HistoryGroup(std::unique_ptr<HistoryItem> first, std::unique_ptr<HistoryItem> second);
+
+    void add(std::unique_ptr<HistoryItem> item) { items.push_back(std::move(item)); }
 
     void apply() override;
+    size_t memory_usage() const override;
+    bool continues(const HistoryItem& next) const override { return items.back()->continues(next); }
 };
 
 class SwitchLayer final : public HistoryItem {
@@ -65,17 +123,23 @@ class SwitchLayer final : public HistoryItem {
     SwitchLayer(int from) : from(from) {}
 
     void apply() override;
+    size_t memory_usage() const override { return sizeof(*this); }
 };
 
 class HistoryManager {
   private:
-    // copying the entire map takes ~1MB so 1000 entries is totally fine
-    static constexpr size_t max_undo_size = 1000;
     // needs insertion/deletion at both sides due to overflow protection
     std::deque<std::unique_ptr<HistoryItem>> undo_buffer;
     std::vector<std::unique_ptr<HistoryItem>> redo_buffer;
+    std::chrono::steady_clock::time_point last_push;
 
   public:
+    // actions pushed within this time of each other can be merged into one undo step
+    static constexpr auto coalesce_window = std::chrono::milliseconds(500);
+
+    // oldest entries are dropped once undo + redo use more than this
+    size_t memory_budget = 256 * 1024 * 1024;
+
     // push new action to history
     void push_action(std::unique_ptr<HistoryItem> item);
 
@@ -83,6 +147,13 @@ class HistoryManager {
     void undo();
     void redo();
     void clear();
+
+    size_t undo_count() const { return undo_buffer.size(); }
+    size_t redo_count() const { return redo_buffer.size(); }
+    size_t memory_usage() const;
+
+  private:
+    void trim();
 };
 
 inline HistoryManager history;
@@ -0,0 +1,228 @@
+#include "journal.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <format>
+
+#include "delta.hpp"
+#include "game_data.hpp"
+#include "hash.hpp"
+
+constexpr char magic[8] = {'A', 'W', 'J', 'R', 'N', 'L', '0', '1'};
+constexpr size_t min_size = 1024 * 1024;
+
+// rooms of the map are xored with the payload
+constexpr uint32_t kind_delta = 0;
+// payload is the whole map file (needed when the room layout changed)
+constexpr uint32_t kind_full = 1;
+
+struct RecordHeader {
+    uint32_t payload_size;
+    uint32_t map;
+    uint32_t kind;
+    uint32_t size; // decoded size for full records
+    uint64_t before; // fast_hash of the rooms before. 0 for full records
+    uint64_t after;
+};
+static_assert(sizeof(RecordHeader) == 32);
+
+static size_t align8(size_t size) {
+    return (size + 7) & ~size_t(7);
+}
+
+static std::span<const uint8_t> room_bytes(const Map& map) {
+    return {(const uint8_t*)map.rooms.data(), map.rooms.size() * sizeof(Room)};
+}
+static std::span<uint8_t> room_bytes(Map& map) {
+    return {(uint8_t*)map.rooms.data(), map.rooms.size() * sizeof(Room)};
+}
+
+// xor deltas only work if no rooms were added, removed or moved
+static bool same_layout(std::span<const uint8_t> a, const Map& b) {
+    if(a.size() != b.rooms.size() * sizeof(Room)) return false;
+    for(size_t i = 0; i < b.rooms.size(); i++) {
+        if(a[i * sizeof(Room)] != b.rooms[i].x || a[i * sizeof(Room) + 1] != b.rooms[i].y) return false;
+    }
+    return true;
+}
+
+std::string Journal::path_for(const std::string& project_path, const std::string& exe_path) {
+    if(project_path.empty()) {
+        // one per exe so editing different exes from the same directory doesn't mix up their journals
+        auto hash = fast_hash({(const uint8_t*)exe_path.data(), exe_path.size()});
+        return std::format("unsaved-{:016x}.journal", hash);
+    }
+    return (std::filesystem::path(project_path) / "journal.awj").string();
+}
+
+size_t Journal::open(const std::string& path_, GameData& data) {
+    file = {};
+    path = path_;
+    end = 0;
+    for(auto& s : shadow) s.clear();
+    versions = {};
+
+#ifdef __EMSCRIPTEN__
+    // nothing survives a reload in the web build anyway
+    return 0;
+#else
+    file = WritableMappedFile(path);
+
+    size_t replayed = 0;
+    if(file.size() >= sizeof(magic) && std::memcmp(file.data(), magic, sizeof(magic)) == 0) {
+        size_t pos = sizeof(magic);
+
+        while(pos + sizeof(RecordHeader) <= file.size()) {
+            RecordHeader head;
+            std::memcpy(&head, file.data() + pos, sizeof(head));
+            if(head.payload_size == 0 || head.map >= 5 || head.kind > kind_full) break;
+            if(pos + sizeof(head) + head.payload_size > file.size()) break;
+            auto payload = std::span<const uint8_t>(file.data() + pos + sizeof(head), head.payload_size);
+
+            try {
+                if(head.kind == kind_delta) {
+                    auto& map = data.map(head.map);
+                    if(fast_hash(room_bytes(map)) != head.before) break;
+
+                    std::vector<uint8_t> rooms(room_bytes(map).begin(), room_bytes(map).end());
+                    xor_rle::apply(rooms, payload);
+                    // record was only partially written
+                    if(fast_hash(rooms) != head.after) break;
+
+                    std::memcpy(room_bytes(map).data(), rooms.data(), rooms.size());
+                } else {
+                    std::vector<uint8_t> map_data(head.size);
+                    xor_rle::apply(map_data, payload);
+                    if(fast_hash(map_data) != head.after) break;
+
+                    data.map(head.map) = Map(map_data);
+                }
+            } catch(std::exception&) {
+                break;
+            }
+
+            data.mark_map_dirty(head.map);
+            replayed++;
+            pos += sizeof(head) + align8(head.payload_size);
+        }
+        end = pos;
+    }
+
+    if(end == 0) {
+        // new or unreadable file
+        file.resize(0);
+        file.resize(min_size);
+        write_header();
+    } else {
+        // anything after the last valid record is garbage from the crash
+        std::memset(file.data() + end, 0, file.size() - end);
+    }
+    // new records continue from the replayed state
+    for(int i = 0; i < 5; i++) {
+        if(!data.map_loaded(i)) continue;
+        take_shadow(i, data.map(i));
+        versions[i] = data.map_version(i);
+    }
+    last_sync = std::chrono::steady_clock::now();
+
+    return replayed;
+#endif
+}
+
+void Journal::sync(const GameData& data, bool force) {
+    if(!file.is_open()) return;
+
+    auto now = std::chrono::steady_clock::now();
+    if(!force && now - last_sync < std::chrono::milliseconds(250)) return;
+    last_sync = now;
+
+    for(int i = 0; i < 5; i++) {
+        if(!data.map_loaded(i)) continue;
+        auto& map = data.map(i);
+
+        if(shadow[i].empty() && data.map_version(i) == 0) {
+            // first time this map is seen and not edited yet
+            take_shadow(i, map);
+            versions[i] = 0;
+            continue;
+        }
+        if(!shadow[i].empty() && data.map_version(i) == versions[i]) continue;
+        versions[i] = data.map_version(i);
+
+        auto rooms = room_bytes(map);
+        if(!shadow[i].empty() && same_layout(shadow[i], map)) {
+            if(std::equal(rooms.begin(), rooms.end(), shadow[i].begin())) continue;
+
+            auto delta = xor_rle::encode(shadow[i], rooms);
+            auto hash = fast_hash(rooms);
+            append(i, kind_delta, 0, shadow_hash[i], hash, delta);
+
+            std::memcpy(shadow[i].data(), rooms.data(), rooms.size());
+            shadow_hash[i] = hash;
+        } else {
+            // map was replaced or edited before it was seen the first time
+            auto map_data = map.save();
+            append(i, kind_full, map_data.size(), 0, fast_hash(map_data), xor_rle::encode(map_data));
+            take_shadow(i, map);
+        }
+    }
+}
+
+void Journal::append(uint32_t map, uint32_t kind, uint32_t size, uint64_t before, uint64_t after, std::span<const uint8_t> payload) {
+    // keeps zeros after the record so replay knows where the journal ends
+    auto needed = end + 2 * sizeof(RecordHeader) + align8(payload.size());
+    if(needed > file.size()) {
+        file.resize(std::max(needed, file.size() * 2));
+    }
+
+    RecordHeader head {(uint32_t)payload.size(), map, kind, size, before, after};
+    std::memcpy(file.data() + end + sizeof(head), payload.data(), payload.size());
+    std::memcpy(file.data() + end, &head, sizeof(head));
+    end += sizeof(head) + align8(payload.size());
+
+    file.flush();
+}
+
+void Journal::take_shadow(int index, const Map& map) {
+    auto rooms = room_bytes(map);
+    shadow[index].assign(rooms.begin(), rooms.end());
+    shadow_hash[index] = fast_hash(rooms);
+}
+
+void Journal::write_header() {
+    std::memcpy(file.data(), magic, sizeof(magic));
+    end = sizeof(magic);
+}
+
+void Journal::rebase(const std::string& path_, size_t mark) {
+    if(!file.is_open()) return;
+    mark = std::clamp(mark, sizeof(magic), end);
+
+    std::vector<uint8_t> records(file.data() + mark, file.data() + end);
+    if(path_ != path) {
+        file = {};
+        std::error_code ec;
+        std::filesystem::remove(path, ec);
+
+        path = path_;
+        file = WritableMappedFile(path);
+    }
+
+    file.resize(std::max(min_size, align8(sizeof(magic) + records.size() + sizeof(RecordHeader))));
+    std::memset(file.data(), 0, file.size());
+    write_header();
+    std::memcpy(file.data() + end, records.data(), records.size());
+    end += records.size();
+    file.flush();
+}
+
+void Journal::discard() {
+    if(!file.is_open()) return;
+    file = {};
+
+    std::error_code ec;
+    std::filesystem::remove(path, ec);
+    path.clear();
+    end = 0;
+}
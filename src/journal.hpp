@@ -0,0 +1,53 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "mapped_file.hpp"
+
+class GameData;
+class Map;
+
+// append only log of map edits made since the last save so they can be recovered after a crash.
+// each sync appends the xor delta between the previously synced state and the current state of every edited map.
+// records are chained by hash so replaying against the wrong data stops instead of corrupting the map
+class Journal {
+    WritableMappedFile file;
+    std::string path;
+    // end of the last complete record
+    size_t end = 0;
+
+    // map data as of the last sync
+    std::array<std::vector<uint8_t>, 5> shadow;
+    std::array<uint64_t, 5> shadow_hash {};
+    std::array<uint32_t, 5> versions {};
+    std::chrono::steady_clock::time_point last_sync;
+
+  public:
+    // <project>/journal.awj or unsaved-<hash of the exe path>.journal in the working directory when only the exe is loaded
+    static std::string path_for(const std::string& project_path, const std::string& exe_path);
+
+    // opens the journal and replays the edits left over from a session that didn't exit cleanly.
+    // returns the number of replayed records
+    size_t open(const std::string& path, GameData& data);
+    // records all map edits since the last sync. throttled unless force is set
+    void sync(const GameData& data, bool force = false);
+
+    // end of the records written so far
+    size_t mark() const { return end; }
+    // drops the records before mark since they're part of a save now. moves the journal if path changed
+    void rebase(const std::string& path, size_t mark);
+    // closes and deletes the journal. used when unsaved changes are dropped on purpose
+    void discard();
+
+  private:
+    void append(uint32_t map, uint32_t kind, uint32_t size, uint64_t before, uint64_t after, std::span<const uint8_t> payload);
+    void take_shadow(int index, const Map& map);
+    void write_header();
+};
+
+inline Journal journal;
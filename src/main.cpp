@@ -20,9 +20,11 @@
 
 #include <nfd.h>
 
+#include "background_save.hpp"
 #include "game_data.hpp"
 #include "globals.hpp"
 #include "history.hpp"
+#include "journal.hpp"
 #include "map_slice.hpp"
 #include "selection.hpp"
 
@@ -60,6 +62,8 @@ int mouse_mode = 0;
 glm::ivec2 mode0_selection = {-1, -1};
 MapTile mode1_placing;
 
+BackgroundSave background_save;
+
 static void glfw_error_callback(int error, const char* description) {
     fprintf(stderr, "GLFW Error %d: %s\n", error, description);
     error_dialog.error("{}: {}", error, description);
@@ -95,21 +99,41 @@ static void onResize(GLFWwindow* window, int width, int height) {
 }
 
 static void load_data() {
+    // atlas and the map that is about to be shown are needed immediately
+    game_data.preload(std::array {255, mapIds[selectedMap]});
+
     render_data->textures.update();
     history.clear();
     updateGeometry = true;
 }
 
+// replays edits that weren't saved before the editor crashed
+static void recover_journal() {
+    try {
+        auto count = journal.open(Journal::path_for(game_data.get_project_path(), game_data.get_exe_path()), game_data);
+        if(count != 0) {
+            error_dialog.warning(std::format("Recovered {} unsaved changes from a previous session.", count));
+        }
+    } catch(std::exception& e) {
+        error_dialog.error(std::format("Failed to open journal: {}", e.what()));
+    }
+}
+
 static bool load_game(const std::string& path) {
     if(!std::filesystem::exists(path)) {
         return false;
     }
 
     try {
-        game_data = GameData::load_exe(path);
-        load_data();
-
+        // pending saves still belong to the old data
+        background_save.finish(game_data);
+        auto data = GameData::load_exe(path);
+        // only dropped once the new data loaded, otherwise the current edits stay journaled
+        journal.discard();
+        game_data = std::move(data);
         selectedMap = 0;
+        recover_journal();
+        load_data();
 
         selection_handler.release();
         history.clear();
@@ -148,10 +172,11 @@ static void dump_assets() {
     try {
         std::filesystem::create_directories(path);
 
+        std::vector<uint8_t> buffer;
         for(size_t i = 0; i < game_data.assets.size(); ++i) {
             auto& item = game_data.assets[i];
 
-            auto dat = game_data.get_asset(i);
+            auto dat = game_data.get_asset(i, buffer);
             auto ptr = dat.data();
             std::string ext = ".bin";
             if(item.type == AssetType::Text) {
@@ -270,7 +295,8 @@ static void randomize() {
     target.insert(711); // = 65th egg
     target.insert(780); // = f.pack
 
-    auto& map = game_data.maps[0];
+    auto& map = game_data.map(0);
+    auto before = map.rooms;
 
     for(auto& room : map.rooms) {
         for(int y2 = 0; y2 < 22; y2++) {
@@ -296,12 +322,16 @@ static void randomize() {
         map.setTile(0, loc.x, loc.y, item);
     }
 
+    history.push_action(std::make_unique<MapChange>(0, before, map.rooms));
+    game_data.mark_map_dirty(0);
     updateGeometry = true;
 }
 
 class {
     std::string export_path = std::filesystem::current_path().string();
     bool has_exported = false;
+    // read when the restore menu opens
+    std::vector<std::string> backups;
 
   public:
     void draw_options() {
@@ -323,6 +353,22 @@ class {
         if(ImGui::MenuItem("Save As...", "Ctrl+Shift+S")) {
             export_explicit();
         }
+
+        ImGui::BeginDisabled(!has_exported);
+        if(ImGui::BeginMenu("Restore Backup")) {
+            if(ImGui::IsWindowAppearing()) backups = GameData::list_backups(export_path);
+            if(backups.empty()) {
+                ImGui::TextDisabled("No backups");
+            }
+            // newest first
+            for(auto it = backups.rbegin(); it != backups.rend(); ++it) {
+                if(ImGui::MenuItem(it->c_str())) {
+                    restore(*it);
+                }
+            }
+            ImGui::EndMenu();
+        }
+        ImGui::EndDisabled();
     }
 
     void export_explicit() {
@@ -362,8 +408,27 @@ class {
 
         export_path = path;
         try {
+            background_save.finish(game_data);
             game_data.load_folder(export_path);
+            journal.discard();
             has_exported = true;
+            recover_journal();
+            load_data();
+
+            selection_handler.release();
+            history.clear();
+        } catch(const std::exception& e) {
+            error_dialog.error(e.what());
+        }
+    }
+
+    void restore(const std::string& name) {
+        try {
+            background_save.finish(game_data);
+            GameData::restore_backup(export_path, name);
+            game_data.load_folder(export_path);
+            journal.discard();
+            recover_journal();
             load_data();
 
             selection_handler.release();
@@ -375,7 +440,7 @@ class {
 
     void save() {
         try {
-            game_data.save_folder(export_path);
+            background_save.start(game_data, export_path);
             has_exported = true;
         } catch(std::exception& e) {
             error_dialog.error(e.what());
@@ -383,6 +448,27 @@ class {
     }
 } saver;
 
+static void export_exe() {
+    static std::string export_path = std::filesystem::current_path().string() + "/Animal Well.exe";
+    std::string path;
+    auto result = NFD::SaveDialog({{"Game", {"exe"}}}, export_path.c_str(), path, window);
+
+    if(result == NFD::Result::Error) {
+        error_dialog.error(NFD::GetError());
+        return;
+    }
+    if(result == NFD::Result::Cancel) {
+        return;
+    }
+    export_path = path;
+
+    try {
+        game_data.save_exe(path);
+    } catch(std::exception& e) {
+        error_dialog.error(e.what());
+    }
+}
+
 static void full_map_screenshot() {
     static std::string export_path = std::filesystem::current_path().string() + "/map.png";
     std::string path;
@@ -478,11 +564,12 @@ static ImGuiID DockSpaceOverViewport() {
                         auto data = readFile(path.c_str());
                         auto map = Map(std::span((uint8_t*)data.data(), data.size()));
 
-                        if(map.coordinate_map != game_data.maps[selectedMap].coordinate_map) {
+                        if(map.coordinate_map != game_data.map(selectedMap).coordinate_map) {
                             error_dialog.warning("Map structure differs from previously loaded map.\nMight break things so be careful.");
                         }
 
-                        game_data.maps[selectedMap] = map;
+                        game_data.map(selectedMap) = map;
+                        game_data.mark_map_dirty(selectedMap);
 
                         history.clear();
                         updateGeometry = true;
@@ -491,6 +578,9 @@ static ImGuiID DockSpaceOverViewport() {
                     }
                 }
             }
+            if(ImGui::MenuItem("Export exe")) {
+                export_exe();
+            }
             ImGui::EndDisabled();
 
             ImGui::EndMenu();
@@ -545,11 +635,21 @@ static ImGuiID DockSpaceOverViewport() {
             if(ImGui::MenuItem("Dump tile textures")) {
                 dump_tile_textures();
             }
+            if(ImGui::BeginMenu("Undo History")) {
+                ImGui::Text("%zu undo, %zu redo steps", history.undo_count(), history.redo_count());
+                ImGui::Text("Memory: %.2f MB", history.memory_usage() / (1024.0 * 1024.0));
+
+                int budget = history.memory_budget / (1024 * 1024);
+                if(ImGui::SliderInt("Budget (MB)", &budget, 1, 4096, "%d", ImGuiSliderFlags_AlwaysClamp | ImGuiSliderFlags_Logarithmic)) {
+                    history.memory_budget = (size_t)budget * 1024 * 1024;
+                }
+                ImGui::EndMenu();
+            }
             if(ImGui::MenuItem("Clear Map")) {
                 selection_handler.release();
 
                 auto& map = currentMap();
-                history.push_action(std::make_unique<MapClear>(map.rooms));
+                auto before = map.rooms;
 
                 for(auto& room : map.rooms) {
                     room.bgId = 0;
@@ -557,6 +657,8 @@ static ImGuiID DockSpaceOverViewport() {
                     room.lighting_index = 0;
                     std::memset(room.tiles, 0, sizeof(room.tiles));
                 }
+                history.push_action(std::make_unique<MapChange>(selectedMap, before, map.rooms));
+                game_data.mark_map_dirty(selectedMap);
                 updateGeometry = true;
             }
 
@@ -565,6 +667,10 @@ static ImGuiID DockSpaceOverViewport() {
             ImGui::EndMenu();
         }
 
+        if(background_save.running()) {
+            ImGui::TextDisabled("Saving... %d%%", (int)(background_save.progress() * 100));
+        }
+
         ImGui::EndMenuBar();
     }
 
@@ -723,15 +829,16 @@ static void handle_input() {
     }
 }
 
-static void ColorEdit4(const char* label, glm::u8vec4& col, ImGuiColorEditFlags flags = 0) {
+static bool ColorEdit4(const char* label, glm::u8vec4& col, ImGuiColorEditFlags flags = 0) {
     float col4[4] {col.r / 255.0f, col.g / 255.0f, col.b / 255.0f, col.a / 255.0f};
 
-    ImGui::ColorEdit4(label, col4, flags);
+    if(!ImGui::ColorEdit4(label, col4, flags)) return false;
 
     col.r = col4[0] * 255.f;
     col.g = col4[1] * 255.f;
     col.b = col4[2] * 255.f;
     col.a = col4[3] * 255.f;
+    return true;
 }
 
 static void DrawPreviewWindow() {
@@ -770,17 +877,20 @@ static void DrawPreviewWindow() {
                     ImGui::SetTooltip("Properties that are stored for each room (40x22 tiles)");
                 }
                 ImGui::Text("position %i %i", room->x, room->y);
-                ImGui::InputScalar("water level", ImGuiDataType_U8, &room->waterLevel);
+                bool changed = ImGui::InputScalar("water level", ImGuiDataType_U8, &room->waterLevel);
                 const uint8_t bg_min = 0, bg_max = 19;
                 if(ImGui::SliderScalar("background id", ImGuiDataType_U8, &room->bgId, &bg_min, &bg_max)) {
                     renderBgs(map);
+                    changed = true;
                 }
 
                 const uint8_t pallet_max = game_data.ambient.size() - 1;
-                ImGui::SliderScalar("Lighting index", ImGuiDataType_U8, &room->lighting_index, &bg_min, &pallet_max);
-                ImGui::InputScalar("idk1", ImGuiDataType_U8, &room->idk1);
-                ImGui::InputScalar("idk2", ImGuiDataType_U8, &room->idk2);
-                ImGui::InputScalar("idk3", ImGuiDataType_U8, &room->idk3);
+                changed |= ImGui::SliderScalar("Lighting index", ImGuiDataType_U8, &room->lighting_index, &bg_min, &pallet_max);
+                changed |= ImGui::InputScalar("idk1", ImGuiDataType_U8, &room->idk1);
+                changed |= ImGui::InputScalar("idk2", ImGuiDataType_U8, &room->idk2);
+                changed |= ImGui::InputScalar("idk3", ImGuiDataType_U8, &room->idk3);
+
+                if(changed) game_data.mark_map_dirty(selectedMap);
             }
 
             if(ImGui::CollapsingHeader("Lighting Data", ImGuiTreeNodeFlags_DefaultOpen)) {
@@ -793,26 +903,28 @@ static void DrawPreviewWindow() {
 
                 ImGui::BeginDisabled(room->lighting_index >= game_data.ambient.size());
 
-                ColorEdit4("ambient light", amb.ambient_light_color);
+                bool changed = ColorEdit4("ambient light", amb.ambient_light_color);
                 ImGui::SameLine();
                 HelpMarker("Alpha channel is unused");
 
-                ColorEdit4("fg ambient light", amb.fg_ambient_light_color);
+                changed |= ColorEdit4("fg ambient light", amb.fg_ambient_light_color);
                 ImGui::SameLine();
                 HelpMarker("Alpha channel is unused");
 
-                ColorEdit4("bg ambient light", amb.bg_ambient_light_color);
+                changed |= ColorEdit4("bg ambient light", amb.bg_ambient_light_color);
                 ImGui::SameLine();
                 HelpMarker("Alpha channel is unused");
 
-                ColorEdit4("fog color", amb.fog_color);
-                ImGui::DragFloat3("color gain", &amb.color_gain.x);
-                ImGui::DragFloat("color saturation", &amb.color_saturation);
-                ImGui::DragFloat("far background reflectivity", &amb.far_background_reflectivity);
+                changed |= ColorEdit4("fog color", amb.fog_color);
+                changed |= ImGui::DragFloat3("color gain", &amb.color_gain.x);
+                changed |= ImGui::DragFloat("color saturation", &amb.color_saturation);
+                changed |= ImGui::DragFloat("far background reflectivity", &amb.far_background_reflectivity);
                 ImGui::EndDisabled();
 
-                if(room->lighting_index < game_data.ambient.size())
+                if(changed && room->lighting_index < game_data.ambient.size()) {
                     game_data.ambient[room->lighting_index] = amb;
+                    game_data.mark_dirty(179);
+                }
             }
 
             auto tp = glm::ivec2(tile_location.x % 40, tile_location.y % 22);
@@ -864,9 +976,13 @@ static void DrawPreviewWindow() {
                 ImGui::BeginDisabled(tile_layer == 2);
                 auto& uv = game_data.uvs[tile.tile_id];
 
-                updateGeometry |= DrawUvFlags(uv);
-                updateGeometry |= ImGui::InputScalarN("UV", ImGuiDataType_U16, &uv.pos, 2);
-                updateGeometry |= ImGui::InputScalarN("UV Size", ImGuiDataType_U16, &uv.size, 2);
+                bool changed = DrawUvFlags(uv);
+                changed |= ImGui::InputScalarN("UV", ImGuiDataType_U16, &uv.pos, 2);
+                changed |= ImGui::InputScalarN("UV Size", ImGuiDataType_U16, &uv.size, 2);
+                if(changed) {
+                    game_data.mark_dirty(254);
+                    updateGeometry = true;
+                }
                 ImGui::EndDisabled();
             }
         }
@@ -922,12 +1038,12 @@ b/g to move to background layer.");
                 selection_handler.release();
 
                 auto tp = glm::ivec2(mouse_world_pos.x % Room::size.x, mouse_world_pos.y % Room::size.y);
-                auto tile_layer = room->tiles[mode1_layer];
-                auto tile = tile_layer[tp.y][tp.x];
+                auto tile = room->tiles[mode1_layer][tp.y][tp.x];
                 if(tile != mode1_placing) {
-                    history.push_action(std::make_unique<SingleChange>(glm::ivec3(mouse_world_pos, mode1_layer), tile));
-                    tile_layer[tp.y][tp.x] = mode1_placing;
-                    updateGeometry = true;
+                    history.push_action(std::make_unique<TileChange>(glm::ivec3(mouse_world_pos, mode1_layer), tile));
+                    // only rebuilds the rooms around the tile
+                    currentMap().setTile(mode1_layer, mouse_world_pos.x, mouse_world_pos.y, mode1_placing);
+                    game_data.mark_map_dirty(selectedMap);
                 }
             }
         }
@@ -984,7 +1100,7 @@ static void draw_water_level() {
         auto bottom_left = glm::vec2 {room.x * 40 * 8, (room.y + 1) * 22 * 8};
         auto size = glm::vec2 {40 * 8, room.waterLevel - 176};
 
-        render_data->overlay.AddRectFilled(bottom_left, bottom_left + size, {}, {}, IM_COL32(0, 0, 255, 76));
+        render_data->overlay.AddRectFilled(bottom_left, bottom_left + size, IM_COL32(0, 0, 255, 76));
     }
 }
 
@@ -1161,6 +1277,10 @@ static int runViewer() {
         printf("Failed to initialize OpenGL context\n");
         return -1;
     }
+    if(!gl_ext::load(glfwGetProcAddress)) {
+        printf("Instanced rendering is not supported (requires OpenGL 3.3)\n");
+        return -1;
+    }
 
     // Ensure we can capture the escape key being pressed below
     glfwSetInputMode(window, GLFW_STICKY_KEYS, GL_TRUE);
@@ -1265,6 +1385,9 @@ static int runViewer() {
         model = glm::translate(model, glm::vec3(camera.position, 0));
         MVP = projection * view * model;
 
+        background_save.poll(game_data);
+        if(game_data.loaded) journal.sync(game_data);
+
         DockSpaceOverViewport();
         error_dialog.drawPopup();
 
@@ -1317,6 +1440,10 @@ static int runViewer() {
     EMSCRIPTEN_MAINLOOP_END;
 #endif
 
+    background_save.finish(game_data);
+    // unsaved changes are only kept when the editor didn't exit normally
+    journal.discard();
+
     // Cleanup
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
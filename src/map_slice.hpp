@@ -1,5 +1,8 @@
 #pragma once
+#include <algorithm>
+#include <cstring>
 #include <glm/glm.hpp>
+#include <span>
 #include <vector>
 
 #include "structures/map.hpp"
@@ -9,46 +12,41 @@ class MapSlice {
     glm::ivec2 _size;
 
   public:
+    // all operations move whole row segments per room. tiles outside of rooms read as empty and aren't written
     void copy(const Map& map, glm::ivec3 pos, glm::ivec2 size) {
-        data.clear();
-        data.reserve(size.x * size.y);
+        data.assign(size.x * size.y, MapTile());
         this->_size = size;
 
-        for(int y = 0; y < size.y; y++) {
-            for(int x = 0; x < size.x; ++x) {
-                data.push_back(map.getTile(pos.z, x + pos.x, y + pos.y).value_or(MapTile()));
-            }
-        }
+        map.for_each_row(pos.z, pos, size, [&](glm::ivec2 p, std::span<const MapTile> tiles) {
+            std::memcpy(&data[offset(pos, p)], tiles.data(), tiles.size_bytes());
+        });
     }
     void cut(Map& map, glm::ivec3 pos, glm::ivec2 size) {
-        data.clear();
-        data.reserve(size.x * size.y);
+        data.assign(size.x * size.y, MapTile());
         this->_size = size;
 
-        for(int y = 0; y < size.y; y++) {
-            for(int x = 0; x < size.x; ++x) {
-                data.push_back(map.getTile(pos.z, x + pos.x, y + pos.y).value_or(MapTile()));
-                map.setTile(pos.z, x + pos.x, y + pos.y, {});
-            }
-        }
+        map.for_each_row(pos.z, pos, size, [&](glm::ivec2 p, std::span<MapTile> tiles) {
+            std::memcpy(&data[offset(pos, p)], tiles.data(), tiles.size_bytes());
+            std::fill(tiles.begin(), tiles.end(), MapTile());
+        });
     }
     void swap(Map& map, glm::ivec3 pos) {
-        for(int y = 0; y < _size.y; ++y) {
-            for(int x = 0; x < _size.x; ++x) {
-                auto t = map.getTile(pos.z, x + pos.x, y + pos.y);
-                if(t.has_value()) {
-                    map.setTile(pos.z, x + pos.x, y + pos.y, data[x + y * _size.x]);
-                }
-                data[x + y * _size.x] = t.value_or(MapTile());
-            }
-        }
+        // shared by all slices so dragging a selection doesn't allocate every frame.
+        // after the swap it holds the previous buffer of this slice
+        thread_local std::vector<MapTile> scratch;
+        scratch.assign(data.size(), MapTile());
+
+        map.for_each_row(pos.z, pos, _size, [&](glm::ivec2 p, std::span<MapTile> tiles) {
+            auto off = offset(pos, p);
+            std::memcpy(&scratch[off], tiles.data(), tiles.size_bytes());
+            std::memcpy(tiles.data(), &data[off], tiles.size_bytes());
+        });
+        data.swap(scratch);
     }
     void paste(Map& map, glm::ivec3 pos) const {
-        for(int y = 0; y < _size.y; ++y) {
-            for(int x = 0; x < _size.x; ++x) {
-                map.setTile(pos.z, x + pos.x, y + pos.y, data[x + y * _size.x]);
-            }
-        }
+        map.for_each_row(pos.z, pos, _size, [&](glm::ivec2 p, std::span<MapTile> tiles) {
+            std::memcpy(tiles.data(), &data[offset(pos, p)], tiles.size_bytes());
+        });
     }
     void fill(const MapTile tile) {
         fill(tile, _size);
@@ -68,4 +66,12 @@ class MapSlice {
     }
 
     glm::ivec2 size() const { return _size; }
+    std::span<MapTile> tiles() { return data; }
+    std::span<const MapTile> tiles() const { return data; }
+
+  private:
+    // index into data for the world position p
+    size_t offset(glm::ivec3 pos, glm::ivec2 p) const {
+        return (p.x - pos.x) + (p.y - pos.y) * _size.x;
+    }
 };
@@ -0,0 +1,293 @@
+#include "mapped_file.hpp"
+
+#include <stdexcept>
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string& path) {
+    auto file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if(file == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("File not found");
+    }
+    file_ = file;
+
+    LARGE_INTEGER size;
+    if(!GetFileSizeEx(file, &size)) {
+        close();
+        throw std::runtime_error("failed to get file size");
+    }
+    size_ = size.QuadPart;
+    if(size_ == 0) return;
+
+    mapping_ = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if(mapping_ == nullptr) {
+        close();
+        throw std::runtime_error("failed to map file");
+    }
+    data_ = (const uint8_t*)MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+    if(data_ == nullptr) {
+        close();
+        throw std::runtime_error("failed to map file");
+    }
+}
+
+void MappedFile::close() {
+    if(data_ != nullptr) UnmapViewOfFile(data_);
+    if(mapping_ != nullptr) CloseHandle(mapping_);
+    if(file_ != nullptr) CloseHandle(file_);
+
+    data_ = nullptr;
+    mapping_ = nullptr;
+    file_ = nullptr;
+    size_ = 0;
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept {
+    data_ = std::exchange(other.data_, nullptr);
+    size_ = std::exchange(other.size_, 0);
+    file_ = std::exchange(other.file_, nullptr);
+    mapping_ = std::exchange(other.mapping_, nullptr);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+    if(this != &other) {
+        close();
+        data_ = std::exchange(other.data_, nullptr);
+        size_ = std::exchange(other.size_, 0);
+        file_ = std::exchange(other.file_, nullptr);
+        mapping_ = std::exchange(other.mapping_, nullptr);
+    }
+    return *this;
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd == -1) {
+        throw std::runtime_error("File not found");
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw std::runtime_error("failed to get file size");
+    }
+    size_ = st.st_size;
+
+    if(size_ != 0) {
+        auto ptr = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(ptr == MAP_FAILED) {
+            ::close(fd);
+            size_ = 0;
+            throw std::runtime_error("failed to map file");
+        }
+        data_ = (const uint8_t*)ptr;
+#ifndef __EMSCRIPTEN__
+        madvise(ptr, size_, MADV_WILLNEED);
+#endif
+    }
+    // the mapping stays valid after the descriptor is closed
+    ::close(fd);
+}
+
+void MappedFile::close() {
+    if(data_ != nullptr) munmap((void*)data_, size_);
+    data_ = nullptr;
+    size_ = 0;
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept {
+    data_ = std::exchange(other.data_, nullptr);
+    size_ = std::exchange(other.size_, 0);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+    if(this != &other) {
+        close();
+        data_ = std::exchange(other.data_, nullptr);
+        size_ = std::exchange(other.size_, 0);
+    }
+    return *this;
+}
+
+#endif
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+#ifdef _WIN32
+
+WritableMappedFile::WritableMappedFile(const std::string& path) {
+    auto file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if(file == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("failed to open file");
+    }
+    file_ = file;
+
+    LARGE_INTEGER size;
+    if(!GetFileSizeEx(file, &size)) {
+        close();
+        throw std::runtime_error("failed to get file size");
+    }
+    size_ = size.QuadPart;
+    map();
+}
+
+void WritableMappedFile::map() {
+    if(size_ == 0) return;
+
+    mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READWRITE, 0, 0, nullptr);
+    if(mapping_ == nullptr) {
+        throw std::runtime_error("failed to map file");
+    }
+    data_ = (uint8_t*)MapViewOfFile(mapping_, FILE_MAP_WRITE, 0, 0, 0);
+    if(data_ == nullptr) {
+        CloseHandle(mapping_);
+        mapping_ = nullptr;
+        throw std::runtime_error("failed to map file");
+    }
+}
+
+void WritableMappedFile::unmap() {
+    if(data_ != nullptr) UnmapViewOfFile(data_);
+    if(mapping_ != nullptr) CloseHandle(mapping_);
+    data_ = nullptr;
+    mapping_ = nullptr;
+}
+
+void WritableMappedFile::resize(size_t size) {
+    unmap();
+
+    LARGE_INTEGER pos;
+    pos.QuadPart = size;
+    if(!SetFilePointerEx(file_, pos, nullptr, FILE_BEGIN) || !SetEndOfFile(file_)) {
+        throw std::runtime_error("failed to resize file");
+    }
+    size_ = size;
+    map();
+}
+
+void WritableMappedFile::flush() {
+    if(data_ != nullptr) FlushViewOfFile(data_, 0);
+}
+
+bool WritableMappedFile::is_open() const {
+    return file_ != nullptr;
+}
+
+void WritableMappedFile::close() {
+    unmap();
+    if(file_ != nullptr) CloseHandle(file_);
+    file_ = nullptr;
+    size_ = 0;
+}
+
+WritableMappedFile::WritableMappedFile(WritableMappedFile&& other) noexcept {
+    data_ = std::exchange(other.data_, nullptr);
+    size_ = std::exchange(other.size_, 0);
+    file_ = std::exchange(other.file_, nullptr);
+    mapping_ = std::exchange(other.mapping_, nullptr);
+}
+
+WritableMappedFile& WritableMappedFile::operator=(WritableMappedFile&& other) noexcept {
+    if(this != &other) {
+        close();
+        data_ = std::exchange(other.data_, nullptr);
+        size_ = std::exchange(other.size_, 0);
+        file_ = std::exchange(other.file_, nullptr);
+        mapping_ = std::exchange(other.mapping_, nullptr);
+    }
+    return *this;
+}
+
+#else
+
+WritableMappedFile::WritableMappedFile(const std::string& path) {
+    fd_ = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if(fd_ == -1) {
+        throw std::runtime_error("failed to open file");
+    }
+
+    struct stat st;
+    if(fstat(fd_, &st) != 0) {
+        close();
+        throw std::runtime_error("failed to get file size");
+    }
+    size_ = st.st_size;
+    map();
+}
+
+void WritableMappedFile::map() {
+    if(size_ == 0) return;
+
+    auto ptr = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if(ptr == MAP_FAILED) {
+        throw std::runtime_error("failed to map file");
+    }
+    data_ = (uint8_t*)ptr;
+}
+
+void WritableMappedFile::unmap() {
+    if(data_ != nullptr) munmap(data_, size_);
+    data_ = nullptr;
+}
+
+void WritableMappedFile::resize(size_t size) {
+    unmap();
+    if(ftruncate(fd_, size) != 0) {
+        throw std::runtime_error("failed to resize file");
+    }
+    size_ = size;
+    map();
+}
+
+void WritableMappedFile::flush() {
+    if(data_ != nullptr) msync(data_, size_, MS_ASYNC);
+}
+
+bool WritableMappedFile::is_open() const {
+    return fd_ != -1;
+}
+
+void WritableMappedFile::close() {
+    unmap();
+    if(fd_ != -1) ::close(fd_);
+    fd_ = -1;
+    size_ = 0;
+}
+
+WritableMappedFile::WritableMappedFile(WritableMappedFile&& other) noexcept {
+    data_ = std::exchange(other.data_, nullptr);
+    size_ = std::exchange(other.size_, 0);
+    fd_ = std::exchange(other.fd_, -1);
+}
+
+WritableMappedFile& WritableMappedFile::operator=(WritableMappedFile&& other) noexcept {
+    if(this != &other) {
+        close();
+        data_ = std::exchange(other.data_, nullptr);
+        size_ = std::exchange(other.size_, 0);
+        fd_ = std::exchange(other.fd_, -1);
+    }
+    return *this;
+}
+
+#endif
+
+WritableMappedFile::~WritableMappedFile() {
+    close();
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string>
+
+// read only memory mapping of a whole file
+class MappedFile {
+    const uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+
+#ifdef _WIN32
+    void* file_ = nullptr;
+    void* mapping_ = nullptr;
+#endif
+
+  public:
+    MappedFile() = default;
+    explicit MappedFile(const std::string& path);
+
+    MappedFile(const MappedFile& other) = delete;
+    MappedFile& operator=(const MappedFile& other) = delete;
+
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+
+    ~MappedFile();
+
+    const uint8_t* data() const { return data_; }
+    size_t size() const { return size_; }
+
+    std::span<const uint8_t> span() const { return {data_, size_}; }
+
+  private:
+    void close();
+};
+
+// read/write mapping of a file that can be resized. changes are written back by the os
+class WritableMappedFile {
+    uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+
+#ifdef _WIN32
+    void* file_ = nullptr;
+    void* mapping_ = nullptr;
+#else
+    int fd_ = -1;
+#endif
+
+  public:
+    WritableMappedFile() = default;
+    // creates the file if it doesn't exist
+    explicit WritableMappedFile(const std::string& path);
+
+    WritableMappedFile(const WritableMappedFile& other) = delete;
+    WritableMappedFile& operator=(const WritableMappedFile& other) = delete;
+
+    WritableMappedFile(WritableMappedFile&& other) noexcept;
+    WritableMappedFile& operator=(WritableMappedFile&& other) noexcept;
+
+    ~WritableMappedFile();
+
+    // new bytes are zero. invalidates data()
+    void resize(size_t size);
+    // starts writing dirty pages to disk without waiting for it
+    void flush();
+
+    bool is_open() const;
+    uint8_t* data() { return data_; }
+    size_t size() const { return size_; }
+
+    std::span<uint8_t> span() { return {data_, size_}; }
+
+  private:
+    void map();
+    void unmap();
+    void close();
+};
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <thread>
+#include <vector>
+
+// calls fn(i) for every i in [0, count) spread over all cores and waits for all of them.
+// fn should only write to its own slot i so the result doesn't depend on the thread count.
+// if any call throws, the exception with the lowest index is rethrown after everything finished
+template<typename F>
+void parallel_for(size_t count, F&& fn) {
+    if(count == 0) return;
+
+#ifdef __EMSCRIPTEN__
+    // no pthreads in the web build
+    const size_t thread_count = 1;
+#else
+    const size_t thread_count = std::min<size_t>(count, std::max(1u, std::thread::hardware_concurrency()));
+#endif
+
+    if(thread_count == 1) {
+        for(size_t i = 0; i < count; i++) {
+            fn(i);
+        }
+        return;
+    }
+
+    std::atomic<size_t> next = 0;
+    std::vector<std::exception_ptr> errors(count);
+
+    auto worker = [&]() {
+        while(true) {
+            auto i = next.fetch_add(1, std::memory_order_relaxed);
+            if(i >= count) break;
+
+            try {
+                fn(i);
+            } catch(...) {
+                errors[i] = std::current_exception();
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(thread_count - 1);
+    for(size_t i = 1; i < thread_count; i++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+
+    for(auto& thread : threads) {
+        thread.join();
+    }
+
+    for(auto& error : errors) {
+        if(error) std::rethrow_exception(error);
+    }
+}
@@ -1,6 +1,7 @@
 #include "geometry.hpp"
 #include "pipeline.hpp"
 #include "renderData.hpp"
+#include "../parallel.hpp"
 
 #include <glm/ext/matrix_clip_space.hpp>
 #include <imgui.h>
@@ -13,11 +14,11 @@ constexpr bool isLamp(uint16_t tile_id) {
     return tile_id == 46 || tile_id == 202 || tile_id == 548 || tile_id == 554 || tile_id == 561 || tile_id == 624 || tile_id == 731;
 }
 
-static void renderVine(int x, int y, int layer, const uv_data& uv, const Room& room) {
+static void renderVine(int x, int y, int layer, const uv_data& uv, const Room& room, GeometryContext& ctx) {
     if(y > 0 && isVine(room.tiles[layer][y - 1][x].tile_id)) return; // is not the first tile
 
     const auto tile_id = room.tiles[layer][y][x].tile_id;
-    const auto room_pos = glm::vec2(room.x * 40 * 8, room.y * 22 * 8);
+    const auto room_pos = glm::ivec2(room.x * 40 * 8, room.y * 22 * 8);
 
     int segments = 4;
     for(size_t i = y + 1; i < 22; i++) {
@@ -49,8 +50,8 @@ static void renderVine(int x, int y, int layer, const uv_data& uv, const Room& r
             x_offset = lookup[(x_hash + j - 1) & 3];
             if(j == 1) x_offset = 0; // segments always use offsets from previous index for some reason?
 
-            auto t = glm::vec2(x_pos + x_offset, y_pos) + room_pos;
-            render_data->add_face(t, t + glm::vec2(1, segment_length), {}, {}, IM_COL32(69, 255, 145, 255));
+            auto t = glm::ivec2(x_pos + x_offset, y_pos) + room_pos;
+            ctx.add_face(t, t + glm::ivec2(1, segment_length), {}, {}, IM_COL32(69, 255, 145, 255));
 
             y_pos += segment_length;
 
@@ -61,11 +62,11 @@ static void renderVine(int x, int y, int layer, const uv_data& uv, const Room& r
 
         if(has_flower) {
             // uvs for tile 312
-            auto uv_ = glm::vec2(uv.pos);
-            auto size = glm::vec2(uv.size);
+            auto uv_ = glm::ivec2(uv.pos);
+            auto size = glm::ivec2(uv.size);
 
-            auto t = glm::vec2(x_pos + x_offset - 1, y_pos) + room_pos;
-            render_data->add_face(t, t + size, uv_, uv_ + size);
+            auto t = glm::ivec2(x_pos + x_offset - 1, y_pos) + room_pos;
+            ctx.add_face(t, t + size, uv_, uv_ + size);
         }
     }
 }
@@ -94,12 +95,12 @@ void renderWaterfall(int x, int y, int layer, const Room& room, RoomBuffers& buf
     buf.waterfalls.push_back({{x, y}, {width * 8, height}, layer});
 }
 
-static void render_tile(MapTile tile, glm::ivec2 tile_pos, int layer, const Map& map, const GameData& game_data, uint32_t color = IM_COL32_WHITE) {
+static void render_tile(MapTile tile, glm::ivec2 tile_pos, int layer, const Map& map, const GameData& game_data, GeometryContext& ctx, uint32_t color = IM_COL32_WHITE) {
     auto& uvs = game_data.uvs;
 
     auto uv = uvs[tile.tile_id];
-    auto right = glm::vec2(uv.size.x, 0);
-    auto down = glm::vec2(0, uv.size.y);
+    auto right = glm::ivec2(uv.size.x, 0);
+    auto down = glm::ivec2(0, uv.size.y);
 
     if(uv.flags & (contiguous | self_contiguous)) {
         auto l_ = map.getTile(layer, tile_pos.x - 1, tile_pos.y);
@@ -160,40 +161,24 @@ static void render_tile(MapTile tile, glm::ivec2 tile_pos, int layer, const Map&
             right = -right;
         }
     }
-    auto uvp = glm::vec2(uv.pos);
+    auto uvp = glm::ivec2(uv.pos);
 
-    auto [mesh, tex] = render_data->get_current();
-    auto atlasSize = glm::vec2(tex.width, tex.height);
+    auto& data = ctx.get_current();
 
-    glm::vec2 world_pos = tile_pos * 8;
-
-    mesh.data.emplace_back(world_pos, uvp / atlasSize, color); // tl
-    mesh.data.emplace_back(world_pos + glm::vec2(uv.size.x, 0), (uvp + right) / atlasSize, color); // tr
-    mesh.data.emplace_back(world_pos + glm::vec2(0, uv.size.y), (uvp + down) / atlasSize, color);  // bl
-
-    mesh.data.emplace_back(world_pos + glm::vec2(uv.size.x, 0), (uvp + right) / atlasSize, color);   // tr
-    mesh.data.emplace_back(world_pos + glm::vec2(uv.size), (uvp + down + right) / atlasSize, color); // br
-    mesh.data.emplace_back(world_pos + glm::vec2(0, uv.size.y), (uvp + down) / atlasSize, color);    // bl
+    glm::ivec2 world_pos = tile_pos * 8 - ctx.origin;
+    data.emplace_back(world_pos, uv.size, uvp, right, down, color);
 
     if(layer == 1 && uv.flags & has_normals) {
-        auto& mesh = render_data->bg_normals;
-
-        auto off = glm::vec2(0, uv.size.y);
+        auto off = glm::ivec2(0, uv.size.y);
         if(uv.flags & (contiguous | self_contiguous)) {
             off.y *= 4;
         }
 
-        mesh.data.emplace_back(world_pos, (uvp + off) / atlasSize, color); // tl
-        mesh.data.emplace_back(world_pos + glm::vec2(uv.size.x, 0), (uvp + right + off) / atlasSize, color); // tr
-        mesh.data.emplace_back(world_pos + glm::vec2(0, uv.size.y), (uvp + down + off) / atlasSize, color);  // bl
-
-        mesh.data.emplace_back(world_pos + glm::vec2(uv.size.x, 0), (uvp + right + off) / atlasSize, color);   // tr
-        mesh.data.emplace_back(world_pos + glm::vec2(uv.size), (uvp + down + right + off) / atlasSize, color); // br
-        mesh.data.emplace_back(world_pos + glm::vec2(0, uv.size.y), (uvp + down + off) / atlasSize, color);    // bl
+        ctx.geometry.bg_normals.emplace_back(world_pos, uv.size, uvp + off, right, down, color);
     }
 }
 
-static void render_lamp(MapTile tile, glm::ivec2 pos, int layer, const Map& map, const GameData& game_data) {
+static void render_lamp(MapTile tile, glm::ivec2 pos, int layer, const Map& map, const GameData& game_data, GeometryContext& ctx) {
     int height = 0;
     while(true) {
         auto t = map.getTile(layer, pos.x, pos.y - height - 1);
@@ -203,134 +188,198 @@ static void render_lamp(MapTile tile, glm::ivec2 pos, int layer, const Map& map,
         height++;
     }
 
-    render_data->push_type(BufferType::midground);
+    ctx.push_type(BufferType::midground);
 
-    render_tile(tile, pos, layer, map, game_data);
+    render_tile(tile, pos, layer, map, game_data, ctx);
     if(height > 0) {
-        render_tile({44, 0, {{tile.horizontal_mirror, false, false, false}}}, {pos.x, pos.y - height}, layer, map, game_data);
+        render_tile({44, 0, {{tile.horizontal_mirror, false, false, false}}}, {pos.x, pos.y - height}, layer, map, game_data, ctx);
 
         MapTile tile_ {45, 0, {{tile.horizontal_mirror, false, false, false}}};
         for(int i = 1; i < height; ++i) {
-            render_tile(tile_, {pos.x, pos.y - i}, layer, map, game_data);
+            render_tile(tile_, {pos.x, pos.y - i}, layer, map, game_data, ctx);
         }
     }
-    render_data->pop_type();
+    ctx.pop_type();
 }
 
-void renderMap(const Map& map, const GameData& game_data) {
+// only touches ctx and the room's own RoomBuffers so rooms can be generated in parallel
+static void render_room(const Map& map, size_t index, const GameData& game_data, GeometryContext& ctx) {
     auto& rd = *render_data;
+    auto& room = map.rooms[index];
+    auto& buff = rd.room_buffers[index];
 
-    rd.fg_tiles.clear();
-    rd.mg_tiles.clear();
-    rd.bg_tiles.clear();
-    rd.bg_normals.clear();
-    rd.bunny.clear();
-    rd.time_capsule.clear();
+    ctx.geometry.clear();
+    buff.waterfalls.clear();
 
-    for(size_t i = 0; i < map.rooms.size(); i++) {
-        auto& room = map.rooms[i];
-        auto& buff = rd.room_buffers[i];
-        buff.waterfalls.clear();
+    const int yellow_sources = room.count_yellow();
 
-        const int yellow_sources = room.count_yellow();
+    for(int layer = 0; layer < 2; layer++) {
+        ctx.push_type(layer == 0 ? BufferType::fg_tile : BufferType::bg_tile);
 
-        for(int layer = 0; layer < 2; layer++) {
-            rd.push_type(layer == 0 ? BufferType::fg_tile : BufferType::bg_tile);
+        for(int y2 = 0; y2 < 22; y2++) {
+            for(int x2 = 0; x2 < 40; x2++) {
+                auto tile = room.tiles[layer][y2][x2];
+                if(tile.tile_id == 0 || tile.tile_id >= 0x400) continue;
 
-            for(int y2 = 0; y2 < 22; y2++) {
-                for(int x2 = 0; x2 < 40; x2++) {
-                    auto tile = room.tiles[layer][y2][x2];
-                    if(tile.tile_id == 0 || tile.tile_id >= 0x400) continue;
+                // lamp rope / mount
+                if(tile.tile_id == 45 || tile.tile_id == 44) continue;
 
-                    // lamp rope / mount
-                    if(tile.tile_id == 45 || tile.tile_id == 44) continue;
+                if(rd.accurate_vines && layer == 0 && isVine(tile.tile_id)) {
+                    ctx.push_type(BufferType::midground);
+                    renderVine(x2, y2, layer, game_data.uvs[312], room, ctx); // uv for
+                    ctx.pop_type();
+                    continue;
+                }
+                if(tile.tile_id == 0x156) {
+                    renderWaterfall(x2, y2, layer, room, buff);
+                }
 
-                    if(rd.accurate_vines && layer == 0 && isVine(tile.tile_id)) {
-                        rd.push_type(BufferType::midground);
-                        renderVine(x2, y2, layer, game_data.uvs[312], room); // uv for
-                        rd.pop_type();
-                        continue;
-                    }
-                    if(tile.tile_id == 0x156) {
-                        renderWaterfall(x2, y2, layer, room, buff);
-                    }
+                auto pos = glm::ivec2(x2 + room.x * 40, y2 + room.y * 22);
+                if(isLamp(tile.tile_id)) {
+                    render_lamp(tile, pos, layer, map, game_data, ctx);
+                    continue;
+                }
+                if(tile.tile_id == 17) {
+                    render_tile(tile, pos, layer, map, game_data, ctx, IM_COL32(69, 255, 145, 255));
+                    continue;
+                }
 
-                    auto pos = glm::ivec2(x2 + room.x * 40, y2 + room.y * 22);
-                    if(isLamp(tile.tile_id)) {
-                        render_lamp(tile, pos, layer, map, game_data);
-                        continue;
-                    }
-                    if(tile.tile_id == 17) {
-                        render_tile(tile, pos, layer, map, game_data, IM_COL32(69, 255, 145, 255));
-                        continue;
-                    }
+                if(game_data.sprites.contains(tile.tile_id)) {
+                    render_sprite_custom([&](glm::ivec2 pos_, glm::u16vec2 size, glm::ivec2 uv_pos, glm::ivec2 uv_size) {
+                        pos_ += pos * 8;
+                        ctx.add_face(pos_, pos_ + glm::ivec2(size), uv_pos, uv_pos + uv_size);
+
+                        if(layer == 1) {
+                            auto p = pos_ - ctx.origin;
+                            AddRectFilled(ctx.geometry.bg_normals, p, p + glm::ivec2(size), uv_pos, uv_pos + uv_size);
+                        }
+                    }, tile, game_data, yellow_sources, &ctx);
+                } else {
+                    render_tile(tile, pos, layer, map, game_data, ctx);
+                }
+            }
+        }
+        ctx.pop_type();
+    }
+}
 
-                    if(game_data.sprites.contains(tile.tile_id)) {
-                        render_sprite_custom([&](glm::ivec2 pos_, glm::u16vec2 size, glm::ivec2 uv_pos, glm::ivec2 uv_size) {
-                            pos_ += pos * 8;
-                            render_data->add_face(pos_, pos_ + glm::ivec2(size), uv_pos, uv_pos + uv_size);
+void renderMap(const Map& map, const GameData& game_data) {
+    auto& rd = *render_data;
 
-                            if(layer == 1) {
-                                auto& mesh = render_data->bg_normals;
+    const auto origin = map_origin(map);
+    auto extent = map.size * Room::size * 8;
+    if(extent.x > INT16_MAX || extent.y > INT16_MAX) {
+        error_dialog.warning("Map is too large to be displayed correctly");
+    }
 
-                                auto& tex = render_data->textures.atlas;
-                                glm::vec2 tex_size {tex.width, tex.height};
+    // every room gets its own geometry which is put together in order afterwards,
+    // so the result doesn't depend on which thread did what
+    std::vector<RoomGeometry> rooms(map.rooms.size());
+    parallel_for(rooms.size(), [&](size_t i) {
+        GeometryContext ctx(rooms[i], origin);
+        render_room(map, i, game_data, ctx);
+    });
+
+    // row by row so the rooms on screen end up next to each other in the buffers
+    auto order = map.rooms_in(map.offset, map.offset + map.size - 1);
+    if(order.size() != map.rooms.size()) {
+        // rooms sharing a position aren't in the coordinate map
+        std::vector<bool> used(map.rooms.size());
+        for(auto i : order) used[i] = true;
+        for(size_t i = 0; i < used.size(); i++) {
+            if(!used[i]) order.push_back(i);
+        }
+    }
 
-                                mesh.AddRectFilled(pos_, pos_ + glm::ivec2(size), glm::vec2(uv_pos) / tex_size, glm::vec2(uv_pos + uv_size) / tex_size, IM_COL32_WHITE);
-                            }
-                        }, tile, game_data, yellow_sources);
-                    } else {
-                        render_tile(tile, pos, layer, map, game_data);
-                    }
+    rd.fg_tiles.build(order, [&](size_t i) { return std::span<const TileQuad>(rooms[i].fg_tiles); });
+    rd.bg_tiles.build(order, [&](size_t i) { return std::span<const TileQuad>(rooms[i].bg_tiles); });
+    rd.bg_normals.build(order, [&](size_t i) { return std::span<const TileQuad>(rooms[i].bg_normals); });
+    rd.bunny.build(order, [&](size_t i) { return std::span<const TileQuad>(rooms[i].bunny); });
+    rd.time_capsule.build(order, [&](size_t i) { return std::span<const TileQuad>(rooms[i].time_capsule); });
+}
+
+// true if the rope of the lamp at pos passes through or ends in one of the dirty rooms
+static bool rope_reaches(glm::ivec2 pos, int layer, const Map& map, const GameData& game_data, const std::vector<bool>& dirty) {
+    // same walk as render_lamp
+    for(int y = pos.y - 1; y >= 0; y--) {
+        auto index = map.roomIndex(pos.x / 40, y / 22);
+        if(index == -1) return false;
+        if(dirty[index]) return true;
+
+        auto t = map.rooms[index].tiles[layer][y % 22][pos.x % 40];
+        if(game_data.uvs[t.tile_id].flags & collides_down) return false;
+    }
+    return false;
+}
+
+// lamp ropes grow upwards until they hit a ceiling which can be several rooms above the lamp.
+// returns rooms plus every room below them with a lamp whose rope is affected
+static std::vector<int> add_lamp_rooms(const Map& map, const GameData& game_data, std::span<const int> rooms) {
+    std::vector<bool> dirty(map.rooms.size());
+    for(auto i : rooms) dirty[i] = true;
+
+    std::vector<int> result(rooms.begin(), rooms.end());
+    for(size_t i = 0; i < map.rooms.size(); i++) {
+        auto& room = map.rooms[i];
+        if(dirty[i]) continue;
+        // only rooms below a dirty one can be affected
+        if(std::none_of(rooms.begin(), rooms.end(), [&](int j) { return map.rooms[j].x == room.x && map.rooms[j].y < room.y; })) continue;
+
+        bool affected = false;
+        for(int layer = 0; layer < 2 && !affected; layer++) {
+            for(int y = 0; y < 22 && !affected; y++) {
+                for(int x = 0; x < 40 && !affected; x++) {
+                    if(!isLamp(room.tiles[layer][y][x].tile_id)) continue;
+                    affected = rope_reaches({room.x * 40 + x, room.y * 22 + y}, layer, map, game_data, dirty);
                 }
             }
-            rd.pop_type();
         }
+        if(affected) result.push_back(i);
     }
+    return result;
+}
+
+void renderRooms(const Map& map, const GameData& game_data, std::span<const int> dirty_rooms) {
+    auto& rd = *render_data;
+
+    RoomGeometry geometry;
+    GeometryContext ctx(geometry, map_origin(map));
 
-    rd.fg_tiles.Buffer();
-    rd.mg_tiles.Buffer();
-    rd.bg_tiles.Buffer();
-    rd.bg_normals.Buffer();
-    rd.bunny.Buffer();
-    rd.time_capsule.Buffer();
+    for(auto i : add_lamp_rooms(map, game_data, dirty_rooms)) {
+        render_room(map, i, game_data, ctx);
+
+        rd.fg_tiles.update(i, geometry.fg_tiles);
+        rd.bg_tiles.update(i, geometry.bg_tiles);
+        rd.bg_normals.update(i, geometry.bg_normals);
+        rd.bunny.update(i, geometry.bunny);
+        rd.time_capsule.update(i, geometry.time_capsule);
+    }
 }
 
 void renderBgs(const Map& map) {
-    constexpr auto texSize = glm::vec2(320 * 4, 180 * 4);
-
-    constexpr glm::vec2 roomUvs[] = {
-        {0, 0},
-        glm::vec2(320 * 3, 180 * 0) / texSize,
-        glm::vec2(320 * 3, 180 * 2) / texSize,
-        glm::vec2(320 * 3, 180 * 2) / texSize,
-        glm::vec2(320 * 0, 180 * 2) / texSize,
-        glm::vec2(320 * 0, 180 * 2) / texSize,
-        glm::vec2(320 * 0, 180 * 1) / texSize,
-        glm::vec2(320 * 2, 180 * 0) / texSize,
-        glm::vec2(320 * 2, 180 * 0) / texSize,
-        glm::vec2(320 * 1, 180 * 1) / texSize,
-        glm::vec2(320 * 2, 180 * 1) / texSize,
-        glm::vec2(320 * 1, 180 * 1) / texSize,
-        glm::vec2(320 * 2, 180 * 3) / texSize,
-        glm::vec2(320 * 0, 180 * 0) / texSize,
-        glm::vec2(320 * 1, 180 * 0) / texSize,
-        glm::vec2(320 * 1, 180 * 2) / texSize,
-        glm::vec2(320 * 3, 180 * 1) / texSize,
-        glm::vec2(320 * 0, 180 * 3) / texSize,
-        glm::vec2(320 * 1, 180 * 3) / texSize,
-        glm::vec2(320 * 2, 180 * 2) / texSize,
-    };
+    // room bgId -> background image
+    constexpr int roomBackgrounds[] = {-1, 3, 11, 11, 8, 8, 4, 2, 2, 5, 6, 5, 14, 0, 1, 9, 7, 12, 13, 10};
+
+    // decode all backgrounds used by this map at once
+    std::vector<int> used;
+    for(auto& room : map.rooms) {
+        if(room.bgId != 0) used.push_back(GameData::background_id(roomBackgrounds[room.bgId]));
+    }
+    game_data.preload(used);
 
     auto& mesh = render_data->bg_text;
     mesh.clear();
 
+    const auto origin = map_origin(map);
     for(auto& room : map.rooms) {
-        auto rp = glm::vec2(room.x * 40 * 8, room.y * 22 * 8);
+        auto rp = glm::ivec2(room.x * 40 * 8, room.y * 22 * 8) - origin;
 
         if(room.bgId != 0) {
-            auto uv = roomUvs[room.bgId];
-            mesh.AddRectFilled(rp, rp + glm::vec2(320, 176), uv, uv + glm::vec2(320, 176) / texSize); // maybe 320x180?
+            auto index = roomBackgrounds[room.bgId];
+            render_data->textures.load_background(index);
+
+            auto uv = Textures::background_pos(index);
+            mesh.AddRectFilled(rp, rp + glm::ivec2(320, 176), uv, uv + glm::ivec2(320, 176)); // maybe 320x180?
         }
     }
 
@@ -341,13 +390,16 @@ void render_visibility(const Map& map, std::span<const uv_data> uvs) {
     auto& vis = render_data->visibility;
     vis.clear();
 
+    const auto origin = map_origin(map);
+
     std::vector<float> lightmap(22 * 40);
     // std::vector<float> lightmap2(22 * 40);
 
     for(auto&& room : map.rooms) {
         for(int y = 0; y < 22; y++) {
+            auto row = room.row(0, y);
             for(int x = 0; x < 40; x++) {
-                const auto tile = room.tiles[0][y][x];
+                const auto tile = row[x];
                 if(tile.tile_id == 0 || tile.tile_id >= 0x400) {
                     lightmap[x + y * 40] = 0;
                     continue;
@@ -387,7 +439,7 @@ void render_visibility(const Map& map, std::span<const uv_data> uvs) {
                 auto v = (int)(255 - lightmap[x + y * 40] * 255);
                 if(v == 0xFF) continue;
 
-                auto pos = glm::ivec2(x + room.x * 40, y + room.y * 22) * 8;
+                auto pos = glm::ivec2(x + room.x * 40, y + room.y * 22) * 8 - origin;
 
                 vis.AddRectFilled(pos, pos + glm::ivec2(8, 8), {}, {}, IM_COL32(v, 0, 0, 255));
             }
@@ -399,7 +451,7 @@ void render_visibility(const Map& map, std::span<const uv_data> uvs) {
 
 constexpr auto zero = glm::vec2(0, 0);
 
-void makeLight(Mesh& mesh, glm::u8vec4 color, int radius) {
+static void makeLight(std::vector<Vertex>& data, glm::vec2 center, glm::u8vec4 color, int radius) {
     auto inner_col = glm::vec3(color) * (color.w / 255.0f);
     auto outer_col = inner_col * glm::vec3(0.35, 0.49, 0.7);
 
@@ -407,7 +459,6 @@ void makeLight(Mesh& mesh, glm::u8vec4 color, int radius) {
     auto inner_c = IM_COL32(inner_col.r, inner_col.g, inner_col.b, 255);
 
     constexpr auto step = std::numbers::pi * 2 / 24;
-    constexpr auto center = glm::vec2(64, 64);
     double angle = 0;
 
     auto p0 = glm::vec2(1, 0);
@@ -422,47 +473,59 @@ void makeLight(Mesh& mesh, glm::u8vec4 color, int radius) {
         auto o2 = (p0 * (float)(radius * 8 + 5));
         auto i2 = (p0 * (float)(radius * 8 - 3));
 
-        mesh.data.emplace_back(center + o1, zero, outer_c);
-        mesh.data.emplace_back(center + o2, zero, outer_c);
-        mesh.data.emplace_back(center, zero, outer_c);
+        data.emplace_back(center + o1, zero, outer_c);
+        data.emplace_back(center + o2, zero, outer_c);
+        data.emplace_back(center, zero, outer_c);
 
-        mesh.data.emplace_back(center + i1, zero, inner_c);
-        mesh.data.emplace_back(center + i2, zero, inner_c);
-        mesh.data.emplace_back(center, zero, inner_c);
+        data.emplace_back(center + i1, zero, inner_c);
+        data.emplace_back(center + i2, zero, inner_c);
+        data.emplace_back(center, zero, inner_c);
     }
 }
 
-void renderLights(const Map& map, std::span<const uv_data> uvs) {
-    auto& mesh = render_data->lights;
-
-    auto& lb = render_data->temp_buffer;
-    lb.Bind();
-    glClearColor(0, 0, 0, 0);
-    glClear(GL_COLOR_BUFFER_BIT);
-
-    render_data->shaders.flat.Use();
-    render_data->shaders.flat.setMat4("MVP", glm::ortho<float>(0, 128, 0, 128, 0.0f, 100.0f));
-
-    auto add_shadow = [&](glm::ivec2 d1, glm::ivec2 d2) {
-        std::array<glm::vec2, 4> clip;
+// convex polygon with room for a quad clipped on all 4 sides
+struct ClipPolygon {
+    std::array<glm::vec2, 8> points;
+    int count = 0;
+};
+
+// keeps the part of poly where sign * (p[axis] - value) <= 0
+static ClipPolygon clip_half(const ClipPolygon& poly, int axis, float value, float sign) {
+    ClipPolygon result;
+    for(int i = 0; i < poly.count; i++) {
+        auto a = poly.points[i];
+        auto b = poly.points[(i + 1) % poly.count];
+        auto da = sign * (a[axis] - value);
+        auto db = sign * (b[axis] - value);
+
+        if(da <= 0) result.points[result.count++] = a;
+        if((da < 0 && db > 0) || (da > 0 && db < 0)) {
+            result.points[result.count++] = a + (b - a) * (da / (da - db));
+        }
+    }
+    return result;
+}
 
-        clip[0] = 60.0f + glm::vec2(d1) * 100.0f; // tl
-        clip[1] = 60.0f + glm::vec2(d2) * 100.0f; // tr
-        clip[2] = 60.0f + glm::vec2(d2) * 8.0f; // br
-        clip[3] = 60.0f + glm::vec2(d1) * 8.0f; // bl
+static ClipPolygon clip_rect(ClipPolygon poly, glm::vec2 min, glm::vec2 max) {
+    poly = clip_half(poly, 0, min.x, -1);
+    poly = clip_half(poly, 0, max.x, 1);
+    poly = clip_half(poly, 1, min.y, -1);
+    return clip_half(poly, 1, max.y, 1);
+}
 
-        mesh.data.emplace_back(clip[0], zero, IM_COL32_BLACK);
-        mesh.data.emplace_back(clip[1], zero, IM_COL32_BLACK);
-        mesh.data.emplace_back(clip[2], zero, IM_COL32_BLACK);
+void renderLights(const Map& map, std::span<const uv_data> uvs) {
+    auto& rd = *render_data;
 
-        mesh.data.emplace_back(clip[0], zero, IM_COL32_BLACK);
-        mesh.data.emplace_back(clip[2], zero, IM_COL32_BLACK);
-        mesh.data.emplace_back(clip[3], zero, IM_COL32_BLACK);
+    struct Light {
+        glm::ivec2 pos; // in tiles
+        glm::u8vec4 color;
+        int radius;
     };
+    std::vector<Light> lights;
 
     for(size_t i = 0; i < map.rooms.size(); i++) {
         auto&& room = map.rooms[i];
-        auto& buff = render_data->room_buffers[i];
+        auto& buff = rd.room_buffers[i];
         buff.lights.clear();
 
         for(int layer = 0; layer < 2; layer++) {
@@ -499,64 +562,120 @@ void renderLights(const Map& map, std::span<const uv_data> uvs) {
                         continue;
                     }
 
-                    mesh.clear();
-                    makeLight(mesh, color, radius);
                     buff.lights.push_back(glm::vec4(x * 8 + 4, y * 8 + 4, (radius + 1) * 8, 0));
+                    lights.push_back({glm::ivec2(x + room.x * 40, y + room.y * 22), color, radius});
+                }
+            }
+        }
+    }
 
-                    auto pos = glm::ivec2(x + room.x * 40, y + room.y * 22);
-                    for(int y1 = -6; y1 <= 6; ++y1) {
-                        for(int x1 = -6; x1 <= 6; ++x1) {
-                            auto t = map.getTile(0, pos.x + x1, pos.y + y1);
-                            if(!t.has_value() || t->tile_id == 0 || !(uvs[t->tile_id].flags & blocks_light))
-                                continue;
-
-                            // todo some tiles with special light blocking eg. 605
-
-                            if(y1 > 0) { // top of tile hit
-                                // auto t1 = map.getTile(0, x + x1, y + y1 - 1);
-                                // if(!t1.has_value() || t1->tile_id == 0 || !(uvs[t1->tile_id].flags & blocks_light))
-                                add_shadow({x1, y1}, {x1 + 1, y1});
-                            } else if(y1 < 0) { // bottom of tile hit
-                                // auto t1 = map.getTile(0, x + x1, y + y1 + 1);
-                                // if(!t1.has_value() || t1->tile_id == 0 || !(uvs[t1->tile_id].flags & blocks_light))
-                                add_shadow({x1 + 1, y1 + 1}, {x1, y1 + 1});
-                            }
-                            if(x1 > 0) { // left of tile hit
-                                // auto t1 = map.getTile(0, x + x1 - 1, y + y1);
-                                // if(!t1.has_value() || t1->tile_id == 0 || !(uvs[t1->tile_id].flags & blocks_light))
-                                add_shadow({x1, y1 + 1}, {x1, y1});
-                            } else if(x1 < 0) { // right of tile hit
-                                // auto t1 = map.getTile(0, x + x1 + 1, y + y1);
-                                // if(!t1.has_value() || t1->tile_id == 0 || !(uvs[t1->tile_id].flags & blocks_light))
-                                add_shadow({x1 + 1, y1}, {x1 + 1, y1 + 1});
-                            }
-                        }
-                    }
+    auto& lb = rd.temp_buffer;
+    lb.Bind();
+    glClearColor(0, 0, 0, 0);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    if(lights.empty()) return;
+
+    // every light mask gets a 128x128 cell in the atlas. 2048x2048 is the smallest max texture size of webgl 2
+    constexpr size_t cell = 128;
+    constexpr size_t columns = 16;
+    constexpr size_t batch_size = columns * 16;
+
+    auto rows = (std::min(lights.size(), batch_size) + columns - 1) / columns;
+    auto atlas_size = glm::ivec2(columns, rows) * (int)cell;
+    rd.light_atlas.resize(atlas_size.x, atlas_size.y);
+
+    auto& mesh = rd.lights;
+    const auto origin = map_origin(map);
+
+    for(size_t first = 0; first < lights.size(); first += batch_size) {
+        auto count = std::min(lights.size() - first, batch_size);
+
+        mesh.clear();
+        rd.light_quads.clear();
 
-                    mesh.Buffer();
+        for(size_t i = 0; i < count; i++) {
+            auto& light = lights[first + i];
+            auto cell_min = glm::vec2(i % columns, i / columns) * (float)cell;
+            auto cell_max = cell_min + (float)cell;
 
-                    render_data->small_light_buffer.Bind();
-                    glViewport(0, 0, 128, 128);
+            makeLight(mesh.data, cell_min + 64.0f, light.color, light.radius);
 
-                    glClearColor(0, 0, 0, 0);
-                    glClear(GL_COLOR_BUFFER_BIT);
+            // shadows reach far past the cell and have to be cut off at its border
+            auto add_shadow = [&](glm::ivec2 d1, glm::ivec2 d2) {
+                ClipPolygon poly;
+                poly.points[0] = cell_min + 60.0f + glm::vec2(d1) * 100.0f; // tl
+                poly.points[1] = cell_min + 60.0f + glm::vec2(d2) * 100.0f; // tr
+                poly.points[2] = cell_min + 60.0f + glm::vec2(d2) * 8.0f; // br
+                poly.points[3] = cell_min + 60.0f + glm::vec2(d1) * 8.0f; // bl
+                poly.count = 4;
 
-                    render_data->shaders.flat.Use();
-                    glDisable(GL_BLEND);
-                    mesh.Draw();
-                    glEnable(GL_BLEND);
+                poly = clip_rect(poly, cell_min, cell_max);
+                for(int j = 1; j + 1 < poly.count; j++) {
+                    mesh.data.emplace_back(poly.points[0], zero, IM_COL32_BLACK);
+                    mesh.data.emplace_back(poly.points[j], zero, IM_COL32_BLACK);
+                    mesh.data.emplace_back(poly.points[j + 1], zero, IM_COL32_BLACK);
+                }
+            };
+
+            auto pos = light.pos;
+            for(int y1 = -6; y1 <= 6; ++y1) {
+                for(int x1 = -6; x1 <= 6; ++x1) {
+                    auto t = map.getTile(0, pos.x + x1, pos.y + y1);
+                    if(!t.has_value() || t->tile_id == 0 || !(uvs[t->tile_id].flags & blocks_light))
+                        continue;
 
-                    lb.Bind();
-                    glViewport(0, 0, lb.tex.width, lb.tex.height);
+                    // todo some tiles with special light blocking eg. 605
 
-                    render_data->shaders.textured.Use();
-                    render_data->small_light_buffer.tex.Bind();
-                    glBlendFunc(GL_ONE, GL_ONE);
-                    pos = pos * 8 + 4;
-                    RenderQuad(pos - 64, pos + 64);
-                    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+                    if(y1 > 0) { // top of tile hit
+                        // auto t1 = map.getTile(0, x + x1, y + y1 - 1);
+                        // if(!t1.has_value() || t1->tile_id == 0 || !(uvs[t1->tile_id].flags & blocks_light))
+                        add_shadow({x1, y1}, {x1 + 1, y1});
+                    } else if(y1 < 0) { // bottom of tile hit
+                        // auto t1 = map.getTile(0, x + x1, y + y1 + 1);
+                        // if(!t1.has_value() || t1->tile_id == 0 || !(uvs[t1->tile_id].flags & blocks_light))
+                        add_shadow({x1 + 1, y1 + 1}, {x1, y1 + 1});
+                    }
+                    if(x1 > 0) { // left of tile hit
+                        // auto t1 = map.getTile(0, x + x1 - 1, y + y1);
+                        // if(!t1.has_value() || t1->tile_id == 0 || !(uvs[t1->tile_id].flags & blocks_light))
+                        add_shadow({x1, y1 + 1}, {x1, y1});
+                    } else if(x1 < 0) { // right of tile hit
+                        // auto t1 = map.getTile(0, x + x1 + 1, y + y1);
+                        // if(!t1.has_value() || t1->tile_id == 0 || !(uvs[t1->tile_id].flags & blocks_light))
+                        add_shadow({x1 + 1, y1}, {x1 + 1, y1 + 1});
+                    }
                 }
             }
+
+            auto center = pos * 8 + 4 - origin;
+            rd.light_quads.AddRectFilled(center - 64, center + 64, glm::ivec2(cell_min), glm::ivec2(cell_max));
         }
+
+        mesh.Buffer();
+        rd.light_quads.Buffer();
+
+        // draw all masks of the batch in one go. triangles of a light are drawn in order so shadows still cover the light
+        rd.light_atlas.Bind();
+        glViewport(0, 0, atlas_size.x, atlas_size.y);
+
+        glClearColor(0, 0, 0, 0);
+        glClear(GL_COLOR_BUFFER_BIT);
+
+        rd.shaders.flat.Use();
+        rd.shaders.flat.setMat4("MVP", glm::ortho<float>(0, atlas_size.x, 0, atlas_size.y, 0.0f, 100.0f));
+        glDisable(GL_BLEND);
+        mesh.Draw();
+        glEnable(GL_BLEND);
+
+        // and add them all to the light buffer
+        lb.Bind();
+        glViewport(0, 0, lb.tex.width, lb.tex.height);
+
+        rd.shaders.tiles.Use();
+        rd.light_atlas.tex.Bind();
+        glBlendFunc(GL_ONE, GL_ONE);
+        rd.light_quads.Draw();
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     }
 }
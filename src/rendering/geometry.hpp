@@ -8,7 +8,14 @@
 #include "../glStuff.hpp"
 #include "renderData.hpp"
 
+// map geometry is stored relative to this to keep the vertices small
+inline glm::ivec2 map_origin(const Map& map) {
+    return map.offset * Room::size * 8;
+}
+
 void renderMap(const Map& map, const GameData& game_data);
+// regenerates only the given rooms. renderMap has to be called for the map first
+void renderRooms(const Map& map, const GameData& game_data, std::span<const int> rooms);
 void renderBgs(const Map& map);
 void render_visibility(const Map& map, std::span<const uv_data> uvs);
 void renderLights(const Map& map, std::span<const uv_data> uvs);
@@ -54,8 +61,9 @@ void render_sprite(F&& f, MapTile tile, uv_data uv, const SpriteData& sprite, gl
 
 // todo custom tile rendering? tile 17 should be green
 
+// ctx is only needed when generating map geometry, some parts of sprites go into different meshes
 template<typename F>
-void render_sprite_custom(F&& f, MapTile tile, const GameData& game_data, int yellow_sources) {
+void render_sprite_custom(F&& f, MapTile tile, const GameData& game_data, int yellow_sources, GeometryContext* ctx = nullptr) {
     constexpr glm::ivec2 zero = {0, 0};
 
     auto uv = game_data.uvs[tile.tile_id];
@@ -72,19 +80,19 @@ void render_sprite_custom(F&& f, MapTile tile, const GameData& game_data, int ye
             render_sprite_layer(f, tile, uv, sprite, 0, 1); // clock face
             // render_sprite_layer(f, tile, uv, sprite, 0, 2);  // speedrun numbers // too complicated to display
 
-            // render_data->push_type(BufferType::midground);
+            // ctx->push_type(BufferType::midground);
             render_sprite_layer(f, tile, uv, sprite, 0, 3); // clock body
             tile.horizontal_mirror = !tile.horizontal_mirror;
             render_sprite_layer(f, tile, uv, sprite, 0, 3); // clock body mirrored
             tile.horizontal_mirror = !tile.horizontal_mirror;
             render_sprite_layer(f, tile, uv, sprite, 0, 10); // top door
-            // render_data->pop_type();
+            // ctx->pop_type();
 
-            render_data->push_type(BufferType::fg_tile);
+            if(ctx) ctx->push_type(BufferType::fg_tile);
             render_sprite_layer(f, tile, uv, sprite, 0, 4); // left door platform
             render_sprite_layer(f, tile, uv, sprite, 0, 5); // middle door platform
             render_sprite_layer(f, tile, uv, sprite, 0, 6); // right door platform
-            render_data->pop_type();
+            if(ctx) ctx->pop_type();
 
             render_sprite_layer(f, tile, uv, sprite, 0, 7); // left door
             render_sprite_layer(f, tile, uv, sprite, 0, 8); // middle door
@@ -140,14 +148,14 @@ void render_sprite_custom(F&& f, MapTile tile, const GameData& game_data, int ye
             render_sprite(f, tile, uv, sprite, zero, 10);
             break;
         case 793: // time capsule
-            render_data->push_type(BufferType::time_capsule);
+            if(ctx) ctx->push_type(BufferType::time_capsule);
             render_sprite(f, tile, uv, sprite);
-            render_data->pop_type();
+            if(ctx) ctx->pop_type();
             break;
         case 794: // space bunny
-            render_data->push_type(BufferType::bunny);
+            if(ctx) ctx->push_type(BufferType::bunny);
             render_sprite(f, tile, uv, sprite);
-            render_data->pop_type();
+            if(ctx) ctx->pop_type();
             break;
         default:
             render_sprite(f, tile, uv, sprite);
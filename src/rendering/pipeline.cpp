@@ -68,7 +68,7 @@ void ingame_render(GameData& game_data, int selectedMap, bool rerender) {
 
     auto start = std::chrono::high_resolution_clock::now();
 
-    auto& map = game_data.maps[selectedMap];
+    auto& map = game_data.map(selectedMap);
     auto size = glm::ivec2(map.size.x, map.size.y) * Room::size * 8;
 
     glViewport(0, 0, size.x, size.y);
@@ -99,13 +99,22 @@ void ingame_render(GameData& game_data, int selectedMap, bool rerender) {
     shaders.flat.Use();
     shaders.flat.setMat4("MVP", MVP);
 
+    shaders.tiles.Use();
+    shaders.tiles.setMat4("MVP", MVP);
+    shaders.tiles.setVec2("origin", map_origin(map));
+    shaders.tiles.setVec4("color", glm::vec4(1));
+
+    shaders.tiles_flat.Use();
+    shaders.tiles_flat.setMat4("MVP", MVP);
+    shaders.tiles_flat.setVec2("origin", map_origin(map));
+
     benchmark("foreground", [&]() {
         rd.fg_buffer.Bind();
         glClearColor(0, 0, 0, 0);
         glClear(GL_COLOR_BUFFER_BIT);
 
         if(rd.show_fg) {
-            shaders.textured.Use();
+            shaders.tiles.Use();
             rd.textures.atlas.Bind();
             rd.fg_tiles.Draw();
         }
@@ -127,7 +136,7 @@ void ingame_render(GameData& game_data, int selectedMap, bool rerender) {
         glClear(GL_COLOR_BUFFER_BIT);
 
         if(rd.show_bg) {
-            shaders.textured.Use();
+            shaders.tiles.Use();
             rd.textures.atlas.Bind();
             rd.bg_tiles.Draw();
         }
@@ -139,7 +148,7 @@ void ingame_render(GameData& game_data, int selectedMap, bool rerender) {
         glClear(GL_COLOR_BUFFER_BIT);
 
         if(rd.show_bg) {
-            shaders.textured.Use();
+            shaders.tiles.Use();
             rd.textures.atlas.Bind();
             rd.bg_normals.Draw();
         }
@@ -151,7 +160,7 @@ void ingame_render(GameData& game_data, int selectedMap, bool rerender) {
         glClear(GL_COLOR_BUFFER_BIT);
 
         benchmark("visibility raw", [&]() {
-            shaders.flat.Use();
+            shaders.tiles_flat.Use();
             rd.visibility.Draw();
         });
 
@@ -219,7 +228,7 @@ void ingame_render(GameData& game_data, int selectedMap, bool rerender) {
         glClearColor(0, 0, 0, 0);
         glClear(GL_COLOR_BUFFER_BIT);
 
-        shaders.textured.Use();
+        shaders.tiles.Use();
         rd.textures.background.Bind();
         rd.bg_text.Draw();
         // logTime("background textures");
@@ -566,11 +575,31 @@ void ingame_render(GameData& game_data, int selectedMap, bool rerender) {
     glViewport(0, 0, width, height);
 }
 
+// part of the map that can be seen through MVP in pixels relative to the map origin
+static std::pair<glm::ivec2, glm::ivec2> view_bounds(const Map& map, const glm::mat4& MVP) {
+    auto inv = glm::inverse(MVP);
+    glm::vec2 a = inv * glm::vec4(-1, -1, 0, 1);
+    glm::vec2 b = inv * glm::vec4(1, 1, 0, 1);
+
+    auto origin = map_origin(map);
+    return {glm::ivec2(glm::floor(glm::min(a, b))) - origin, glm::ivec2(glm::ceil(glm::max(a, b))) - origin};
+}
+
 void doRender(bool updateGeometry, GameData& game_data, int selectedMap, glm::mat4& MVP, Textured_Framebuffer* frameBuffer) {
-    auto& map = game_data.maps[selectedMap];
+    auto& map = game_data.map(selectedMap);
     auto& rd = *render_data;
     times.clear();
 
+    auto dirty_rooms = map.take_dirty_rooms();
+    if(!updateGeometry && !dirty_rooms.empty()) {
+        // the ingame renderer needs visibility and lights of the whole map
+        if(rd.accurate_render || rd.fg_tiles.room_count() != map.rooms.size()) {
+            updateGeometry = true;
+        } else {
+            benchmark("verts rooms", [&]() { renderRooms(map, game_data, dirty_rooms); });
+        }
+    }
+
     if(updateGeometry) {
         auto& bufs = render_data->room_buffers;
         if(bufs.size() < map.rooms.size()) {
@@ -608,37 +637,45 @@ void doRender(bool updateGeometry, GameData& game_data, int selectedMap, glm::ma
         glClearColor(0.45f, 0.45f, 0.45f, 1.00f);
         glClear(GL_COLOR_BUFFER_BIT);
 
-        rd.shaders.textured.Use();
-        rd.shaders.textured.setMat4("MVP", MVP);
+        auto [view_min, view_max] = view_bounds(map, MVP);
+
+        auto& shader = rd.shaders.tiles;
+        shader.Use();
+        shader.setMat4("MVP", MVP);
+        shader.setVec2("origin", map_origin(map));
+        shader.setVec4("color", {1, 1, 1, 1});
 
         if(rd.show_bg_tex) { // draw background textures
-            rd.shaders.textured.setVec4("color", rd.bg_tex_color);
+            shader.setVec4("color", rd.bg_tex_color);
             rd.textures.background.Bind();
             rd.bg_text.Draw();
         }
 
         if(rd.show_bg) { // draw background tiles
             rd.textures.atlas.Bind();
-            rd.shaders.textured.setVec4("color", rd.bg_color);
-            rd.bg_tiles.Draw();
+            shader.setVec4("color", rd.bg_color);
+            rd.bg_tiles.Draw(view_min, view_max);
         }
 
-        rd.textures.bunny.Bind();
-        rd.bunny.Draw();
-
-        rd.textures.time_capsule.Bind();
-        rd.time_capsule.Draw();
+        if(!rd.bunny.empty()) {
+            rd.textures.get_bunny().Bind();
+            rd.bunny.Draw(view_min, view_max);
+        }
+        if(!rd.time_capsule.empty()) {
+            rd.textures.get_time_capsule().Bind();
+            rd.time_capsule.Draw(view_min, view_max);
+        }
 
         if(rd.show_fg) { // draw foreground tiles
             rd.textures.atlas.Bind();
-            rd.shaders.textured.setVec4("color", rd.fg_color);
-            rd.fg_tiles.Draw();
+            shader.setVec4("color", rd.fg_color);
+            rd.fg_tiles.Draw(view_min, view_max);
         }
     }
 
     // draw overlay (selection, water level)
-    rd.shaders.flat.Use();
-    rd.shaders.flat.setMat4("MVP", MVP);
+    rd.shaders.lines.Use();
+    rd.shaders.lines.setMat4("MVP", MVP);
     rd.overlay.Buffer();
     rd.overlay.Draw();
 }
@@ -1,6 +1,7 @@
 #pragma once
 #include "../glStuff.hpp"
 #include "../globals.hpp"
+#include <bitset>
 #include <memory>
 
 enum class BufferType {
@@ -16,6 +17,11 @@ struct Shaders {
     ShaderProgram flat     {"src/shaders/mvp.vs", "src/shaders/flat.fs"};
     ShaderProgram textured {"src/shaders/mvp.vs", "src/shaders/textured.fs"};
     ShaderProgram copy     {"src/shaders/raw.vs", "src/shaders/textured.fs"};
+    // for TileMesh
+    ShaderProgram tiles      {"src/shaders/tile.vs", "src/shaders/textured.fs"};
+    ShaderProgram tiles_flat {"src/shaders/tile.vs", "src/shaders/flat.fs"};
+    // for LineMesh
+    ShaderProgram lines {"src/shaders/line.vs", "src/shaders/flat.fs"};
 
     ShaderProgram visibility      {"src/shaders/raw.vs", "src/shaders/visibility.fs"};
     ShaderProgram light           {"src/shaders/raw.vs", "src/shaders/light_blur.fs"};
@@ -35,12 +41,10 @@ struct Shaders {
 struct Textures {
     Texture atlas;
     Texture background {320 * 4, 180 * 4};
-    Texture bunny;
-    Texture time_capsule;
 
     void update() {
         { // chroma key atlas texture
-            auto tex = game_data.atlas.copy();
+            auto tex = game_data.atlas().copy();
             // chroma key cyan and replace with alpha
             auto vptr = tex.data();
             for(int i = 0; i < tex.width() * tex.height(); ++i) {
@@ -51,30 +55,46 @@ struct Textures {
             atlas.Load(tex);
         }
 
-        bunny.Load(game_data.bunny);
-        time_capsule.Load(game_data.time_capsule);
+        // everything else is uploaded once it's used
+        bunny_loaded = false;
+        time_capsule_loaded = false;
+        backgrounds_loaded.reset();
+    }
 
-        background.Bind();
+    Texture& get_bunny() {
+        if(!bunny_loaded) {
+            bunny.Load(game_data.bunny());
+            bunny_loaded = true;
+        }
+        return bunny;
+    }
+    Texture& get_time_capsule() {
+        if(!time_capsule_loaded) {
+            time_capsule.Load(game_data.time_capsule());
+            time_capsule_loaded = true;
+        }
+        return time_capsule;
+    }
 
-        background.LoadSubImage(320 * 0, 180 * 0, game_data.backgrounds[0]); // 13
-        background.LoadSubImage(320 * 1, 180 * 0, game_data.backgrounds[1]); // 14
-        background.LoadSubImage(320 * 2, 180 * 0, game_data.backgrounds[2]); // 7, 8
-        background.LoadSubImage(320 * 3, 180 * 0, game_data.backgrounds[3]); // 1
+    // backgrounds are stored in a 4x4 grid of 320x180 cells
+    static glm::ivec2 background_pos(int index) {
+        return glm::ivec2(index % 4 * 320, index / 4 * 180);
+    }
+    void load_background(int index) {
+        if(backgrounds_loaded[index]) return;
 
-        background.LoadSubImage(320 * 0, 180 * 1, game_data.backgrounds[4]); // 6
-        background.LoadSubImage(320 * 1, 180 * 1, game_data.backgrounds[5]); // 9, 11
-        background.LoadSubImage(320 * 2, 180 * 1, game_data.backgrounds[6]); // 10
-        background.LoadSubImage(320 * 3, 180 * 1, game_data.backgrounds[7]); // 16
+        auto pos = background_pos(index);
+        background.LoadSubImage(pos.x, pos.y, game_data.background(index));
+        backgrounds_loaded[index] = true;
+    }
 
-        background.LoadSubImage(320 * 0, 180 * 2, game_data.backgrounds[8]); // 4, 5
-        background.LoadSubImage(320 * 1, 180 * 2, game_data.backgrounds[9]); // 15
-        background.LoadSubImage(320 * 2, 180 * 2, game_data.backgrounds[10]); // 19
-        background.LoadSubImage(320 * 3, 180 * 2, game_data.backgrounds[11]); // 2, 3
+  private:
+    Texture bunny;
+    Texture time_capsule;
 
-        background.LoadSubImage(320 * 0, 180 * 3, game_data.backgrounds[12]); // 17
-        background.LoadSubImage(320 * 1, 180 * 3, game_data.backgrounds[13]); // 18
-        background.LoadSubImage(320 * 2, 180 * 3, game_data.backgrounds[14]); // 12
-    }
+    bool bunny_loaded = false;
+    bool time_capsule_loaded = false;
+    std::bitset<15> backgrounds_loaded;
 };
 
 struct Waterfall {
@@ -89,21 +109,184 @@ struct RoomBuffers {
     // Mesh waterfall_mesh;
 };
 
+// quads generated for a single room, one list for every map mesh
+struct RoomGeometry {
+    std::vector<TileQuad> fg_tiles, bg_tiles, bg_normals, bunny, time_capsule;
+
+    void clear() {
+        fg_tiles.clear();
+        bg_tiles.clear();
+        bg_normals.clear();
+        bunny.clear();
+        time_capsule.clear();
+    }
+};
+
+// state for generating the geometry of one room. every thread has its own
+struct GeometryContext {
+    RoomGeometry& geometry;
+    // world position of the map origin in pixels. vertices are stored relative to it
+    glm::ivec2 origin;
+
+    std::vector<BufferType> type_stack;
+
+    GeometryContext(RoomGeometry& geometry, glm::ivec2 origin) : geometry(geometry), origin(origin) {}
+
+    void push_type(BufferType type) {
+        type_stack.push_back(type);
+    }
+    void pop_type() {
+        type_stack.pop_back();
+    }
+
+    std::vector<TileQuad>& get_current() {
+        switch(type_stack.back()) {
+            case BufferType::fg_tile: return geometry.fg_tiles;
+            case BufferType::bg_tile: return geometry.bg_tiles;
+            case BufferType::midground: return geometry.fg_tiles; // todo add midground buffer
+            case BufferType::bunny: return geometry.bunny;
+            case BufferType::time_capsule: return geometry.time_capsule;
+            default:
+                assert(false);
+                throw std::runtime_error("unreachable");
+        }
+    }
+
+    // p_min and p_max in world pixels
+    void add_face(glm::ivec2 p_min, glm::ivec2 p_max, glm::ivec2 uv_min, glm::ivec2 uv_max, uint32_t col = IM_COL32_WHITE) {
+        AddRectFilled(get_current(), p_min - origin, p_max - origin, uv_min, uv_max, col);
+    }
+};
+
+// mesh that holds the quads of every room in its own range so a single room can be regenerated
+// and uploaded without touching the rest. ranges have some room to grow, unused space is filled with empty quads
+struct RoomMesh {
+    TileMesh mesh;
+
+    // replaces everything. rooms are stored in the given order, get(i) returns the quads of room i
+    template<typename F>
+    void build(std::span<const int> order, F&& get) {
+        std::vector<TileQuad> data;
+        std::vector<Range> new_ranges(order.size());
+        quad_count = 0;
+
+        for(auto i : order) {
+            std::span<const TileQuad> quads = get(i);
+            new_ranges[i] = {data.size(), quads.size(), capacity(quads.size())};
+            new_ranges[i].set_bounds(quads);
+            quad_count += quads.size();
+
+            data.insert(data.end(), quads.begin(), quads.end());
+            data.resize(new_ranges[i].start + new_ranges[i].capacity, TileQuad());
+        }
+
+        mesh.data = std::move(data);
+        ranges = std::move(new_ranges);
+        this->order.assign(order.begin(), order.end());
+        mesh.Buffer();
+    }
+
+    // replaces the quads of one room. only uploads that room unless it outgrew its range
+    void update(size_t room, std::span<const TileQuad> quads) {
+        auto& range = ranges[room];
+        if(quads.size() > range.capacity) {
+            // lay everything out again. the old data stays valid until build is done
+            auto old = std::move(mesh.data);
+            auto old_order = std::move(order);
+            build(old_order, [&](size_t i) {
+                if(i == room) return quads;
+                return std::span<const TileQuad>(old.data() + ranges[i].start, ranges[i].count);
+            });
+            return;
+        }
+
+        auto dirty = std::max(range.count, quads.size());
+        auto begin = mesh.data.begin() + range.start;
+        std::copy(quads.begin(), quads.end(), begin);
+        std::fill(begin + quads.size(), begin + dirty, TileQuad());
+
+        quad_count += quads.size();
+        quad_count -= range.count;
+        range.count = quads.size();
+        range.set_bounds(quads);
+
+        mesh.vbo.BufferSubData(range.start * sizeof(TileQuad), &mesh.data[range.start], dirty * sizeof(TileQuad));
+    }
+
+    size_t room_count() const { return ranges.size(); }
+    bool empty() const { return quad_count == 0; }
+
+    void Draw() {
+        if(!empty()) mesh.Draw();
+    }
+
+    // draws the rooms with quads inside [view_min, view_max] (relative to the map origin).
+    // rooms are stored row by row so the visible ones mostly end up in a few continuous runs
+    void Draw(glm::ivec2 view_min, glm::ivec2 view_max) {
+        if(empty()) return;
+
+        size_t start = 0, count = 0;
+        for(auto i : order) {
+            auto& range = ranges[i];
+            // padding of empty rooms in between is empty quads which don't produce any fragments
+            if(range.count == 0) continue;
+
+            bool visible = range.max.x >= view_min.x && range.min.x <= view_max.x && range.max.y >= view_min.y && range.min.y <= view_max.y;
+            if(!visible) {
+                mesh.Draw(start, count);
+                count = 0;
+            } else if(count == 0) {
+                start = range.start;
+                count = range.count;
+            } else {
+                count = range.start + range.count - start;
+            }
+        }
+        mesh.Draw(start, count);
+    }
+
+  private:
+    struct Range {
+        size_t start, count, capacity;
+        // area covered by the quads. sprites and lamp ropes reach outside of their room
+        glm::ivec2 min {0}, max {0};
+
+        void set_bounds(std::span<const TileQuad> quads) {
+            min = glm::ivec2(INT32_MAX);
+            max = glm::ivec2(INT32_MIN);
+            for(auto& quad : quads) {
+                min = glm::min(min, glm::ivec2(quad.position));
+                max = glm::max(max, glm::ivec2(quad.position) + glm::ivec2(quad.size));
+            }
+        }
+    };
+    std::vector<Range> ranges;
+    std::vector<int> order;
+    size_t quad_count = 0;
+
+    // a quarter of extra space and at least 16 quads so single edits don't need a new layout.
+    // rooms without quads get nothing since most never get any
+    static size_t capacity(size_t count) {
+        if(count == 0) return 0;
+        return count + std::max<size_t>(count / 4, 16);
+    }
+};
+
 struct RenderData {
     Shaders shaders;
     Textures textures;
 
-    Mesh fg_tiles, bg_tiles, bg_text, bg_normals, overlay;
-    Mesh bunny;
-    Mesh time_capsule;
-    Mesh waterfall_mesh;
+    RoomMesh fg_tiles, bg_tiles, bg_normals;
+    RoomMesh bunny;
+    RoomMesh time_capsule;
+    TileMesh bg_text;
+    LineMesh overlay {GL_STREAM_DRAW};
+    Mesh waterfall_mesh {GL_STREAM_DRAW};
 
     glm::vec4 bg_color {0.8, 0.8, 0.8, 1};
     glm::vec4 fg_color {1, 1, 1, 1};
     glm::vec4 bg_tex_color {0.5, 0.5, 0.5, 1};
 
-    std::vector<BufferType> type_stack;
-
     bool show_fg = true;
     bool show_bg = true;
     bool show_bg_tex = true;
@@ -116,12 +299,14 @@ struct RenderData {
     bool accurate_render = false;
 
     // Textured_Framebuffer visibility_buffer;
-    Mesh visibility;
+    TileMesh visibility;
     Mesh mg_tiles;
-    Mesh water;
-    Mesh lights;
+    Mesh water {GL_STREAM_DRAW};
+    Mesh lights {GL_STREAM_DRAW};
 
-    Textured_Framebuffer small_light_buffer {128, 128};
+    // 128x128 cell per light mask
+    Textured_Framebuffer light_atlas {0, 0};
+    TileMesh light_quads;
 
     Textured_Framebuffer fg_buffer {0, 0};
     Textured_Framebuffer mg_buffer {0, 0};
@@ -140,32 +325,6 @@ struct RenderData {
     RenderData() = default;
     RenderData(const RenderData&) = delete;
     void operator=(const RenderData&) = delete;
-
-    void push_type(BufferType type) {
-        type_stack.push_back(type);
-    }
-    void pop_type() {
-        type_stack.pop_back();
-    }
-
-    std::tuple<Mesh&, Texture&> get_current() {
-        switch(type_stack.back()) {
-            case BufferType::fg_tile: return {fg_tiles, textures.atlas};
-            case BufferType::bg_tile: return {bg_tiles, textures.atlas};
-            case BufferType::midground: return {fg_tiles, textures.atlas}; // todo add midground buffer
-            case BufferType::bunny: return {bunny, textures.bunny};
-            case BufferType::time_capsule: return {time_capsule, textures.time_capsule};
-            default:
-                assert(false);
-                throw std::runtime_error("unreachable");
-        }
-    }
-
-    void add_face(glm::vec2 p_min, glm::vec2 p_max, glm::ivec2 uv_min, glm::ivec2 uv_max, uint32_t col = IM_COL32_WHITE) {
-        auto [mesh, tex] = get_current();
-        glm::vec2 tex_size {tex.width, tex.height};
-        mesh.AddRectFilled(p_min, p_max, glm::vec2(uv_min) / tex_size, glm::vec2(uv_max) / tex_size, col);
-    }
 };
 
 inline std::unique_ptr<RenderData> render_data;
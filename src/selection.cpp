@@ -31,6 +31,7 @@ void SelectionHandler::start_from_paste(glm::ivec2 pos, const MapSlice& data) {
 
     // put copied tiles down
     data.paste(currentMap(), orig_pos);
+    game_data.mark_map_dirty(selectedMap);
     selection_buffer = data;
 }
 
@@ -54,7 +55,7 @@ void SelectionHandler::erase() {
     // orign_pos == current_pos after apply
     temp_buffer.paste(currentMap(), orig_pos); // put original data back
     history.push_action(std::make_unique<AreaChange>(orig_pos, selection_buffer));
-    updateGeometry = true;
+    game_data.mark_map_dirty(selectedMap);
     release();
 }
 
@@ -72,7 +73,7 @@ void SelectionHandler::change_layer(int from, int to) {
     temp_buffer.paste(map, glm::ivec3(start_pos, from)); // put original data back
     temp_buffer.copy(map, glm::ivec3(start_pos, to), _size); // store underlying
     selection_buffer.paste(map, glm::ivec3(start_pos, to)); // place preview on top
-    updateGeometry = true;
+    game_data.mark_map_dirty(selectedMap);
 }
 
 void SelectionHandler::move(glm::ivec2 delta) {
@@ -87,8 +88,7 @@ void SelectionHandler::move(glm::ivec2 delta) {
     // store underlying
     temp_buffer.copy(map, glm::ivec3(start_pos, mode1_layer), _size);
     selection_buffer.paste(map, glm::ivec3(start_pos, mode1_layer)); // place preview on top
-
-    updateGeometry = true;
+    game_data.mark_map_dirty(selectedMap);
 }
 
 bool SelectionHandler::selecting() const {
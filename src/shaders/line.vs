@@ -0,0 +1,25 @@
+#version 330 core
+
+// one instance per line, expanded to a quad of the given thickness
+layout(location = 0) in vec2 lineStart;
+layout(location = 1) in vec2 lineEnd;
+layout(location = 2) in float lineThickness;
+layout(location = 3) in vec4 lineColor;
+
+out vec2 TexCoords;
+out vec4 Color;
+
+uniform mat4 MVP;
+
+void main() {
+    // drawn as a triangle strip of 4 vertices
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+
+    vec2 dir = normalize(lineEnd - lineStart) * (lineThickness * 0.5);
+    vec2 normal = vec2(dir.y, -dir.x);
+
+    vec2 pos = mix(lineStart, lineEnd, corner.x) + normal * (1.0 - corner.y * 2.0);
+    gl_Position = MVP * vec4(pos, 0, 1);
+    TexCoords = vec2(0);
+    Color = lineColor;
+}
@@ -0,0 +1,30 @@
+#version 330 core
+
+// one instance per quad. positions are in pixels relative to the map origin and uvs in texels
+layout(location = 0) in vec2 quadPosition;
+layout(location = 1) in vec2 quadSize;
+layout(location = 2) in vec2 quadUv;
+layout(location = 3) in vec2 quadUvSize;
+layout(location = 4) in vec4 quadColor;
+layout(location = 5) in uint quadFlags; // 1 mirror x, 2 mirror y, 4 transpose
+
+out vec2 TexCoords;
+out vec4 Color;
+
+uniform mat4 MVP;
+uniform vec2 origin;
+uniform sampler2D atlas;
+
+void main() {
+    // drawn as a triangle strip of 4 vertices
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+    gl_Position = MVP * vec4(origin + quadPosition + corner * quadSize, 0, 1);
+
+    vec2 t = corner;
+    if((quadFlags & 4u) != 0u) t = t.yx;
+    if((quadFlags & 1u) != 0u) t.x = 1.0 - t.x;
+    if((quadFlags & 2u) != 0u) t.y = 1.0 - t.y;
+
+    TexCoords = (quadUv + t * quadUvSize) / vec2(textureSize(atlas, 0));
+    Color = quadColor;
+}
@@ -1,6 +1,8 @@
 #include "asset.hpp"
 
 #include <array>
+#include <atomic>
+#include <cassert>
 #include <filesystem>
 #include <fstream>
 
@@ -12,17 +14,42 @@ static std::array<uint8_t, 16> keys[3] = {
     {0x11, 0x14, 0x18, 0x14, 0x88, 0x82, 0x42, 0x82, 0x28, 0x24, 0x88, 0x82, 0x11, 0x18, 0x44, 0x11}  // time capsule works for 222/277/377
 };
 
-bool tryDecrypt(const asset_entry& item, std::span<const uint8_t> data, std::vector<uint8_t>& out) {
-    if(((uint8_t)item.type & 192) == 64) {
-        for(auto& k : keys) {
-            if(decrypt(data, k, out)) {
-                return true;
-            }
-        }
+static const AesKey key_schedules[3] = {AesKey(keys[0]), AesKey(keys[1]), AesKey(keys[2])};
+
+// asset id -> key index + 1. 0 if not known yet
+static std::array<std::atomic<uint8_t>, asset_count> known_keys;
+
+bool tryDecrypt(const asset_entry& item, int asset_id, std::span<const uint8_t> data, std::vector<uint8_t>& out) {
+    if(((uint8_t)item.type & 192) != 64) return false;
+
+    assert(asset_id >= 0 && asset_id < (int)asset_count);
+    auto& known = known_keys[asset_id];
+    int last = known.load(std::memory_order_relaxed) - 1;
+
+    if(last != -1 && decrypt(data, key_schedules[last], out)) {
+        return true;
+    }
+
+    // probe the first block with each key before decrypting everything
+    for(int i = 0; i < 3; i++) {
+        if(i == last || !check_key(data, key_schedules[i])) continue;
+
+        known.store(i + 1, std::memory_order_relaxed);
+        return decrypt(data, key_schedules[i], out);
     }
     return false;
 }
 
-std::vector<uint8_t> encrypt(std::span<const uint8_t> data, int keyNum) {
-    return encrypt(data, keys[keyNum]);
+int getKeyIndex(int asset_id) {
+    assert(asset_id >= 0 && asset_id < (int)asset_count);
+    return known_keys[asset_id].load(std::memory_order_relaxed) - 1;
+}
+
+const AesKey& getKey(int keyNum) {
+    assert(keyNum >= 0 && keyNum < 3);
+    return key_schedules[keyNum];
+}
+
+std::vector<uint8_t> encrypt(std::span<const uint8_t> data, int keyNum, bool deterministic_iv) {
+    return encrypt(data, getKey(keyNum), deterministic_iv);
 }
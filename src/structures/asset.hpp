@@ -33,6 +33,14 @@ struct asset_entry {
 };
 static_assert(sizeof(asset_entry) == 0x30);
 
-bool tryDecrypt(const asset_entry& item, std::span<const uint8_t> data, std::vector<uint8_t>& out);
+constexpr size_t asset_count = 676;
 
-std::vector<uint8_t> encrypt(std::span<const uint8_t> data, int keyNum);
+// the key that worked for an asset is remembered so later loads don't have to try every key
+bool tryDecrypt(const asset_entry& item, int asset_id, std::span<const uint8_t> data, std::vector<uint8_t>& out);
+// index of the key that decrypted the asset or -1 if it hasn't been decrypted yet
+int getKeyIndex(int asset_id);
+
+struct AesKey;
+const AesKey& getKey(int keyNum);
+
+std::vector<uint8_t> encrypt(std::span<const uint8_t> data, int keyNum, bool deterministic_iv = false);
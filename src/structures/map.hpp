@@ -1,11 +1,13 @@
 #pragma once
 
+#include <algorithm>
+#include <cassert>
 #include <cstdint>
 #include <cstring>
 #include <optional>
 #include <span>
 #include <stdexcept>
-#include <unordered_map>
+#include <vector>
 
 #include <glm/glm.hpp>
 
@@ -88,6 +90,20 @@ struct Room {
         assert(y >= 0 && y < 22);
         return tiles[layer][y][x];
     }
+
+    // tiles [x_start, x_end) of the row at row_y
+    std::span<MapTile> row(int layer, int row_y, int x_start = 0, int x_end = 40) {
+        assert(layer == 0 || layer == 1);
+        assert(row_y >= 0 && row_y < 22);
+        assert(x_start >= 0 && x_start <= x_end && x_end <= 40);
+        return std::span(tiles[layer][row_y] + x_start, x_end - x_start);
+    }
+    std::span<const MapTile> row(int layer, int row_y, int x_start = 0, int x_end = 40) const {
+        assert(layer == 0 || layer == 1);
+        assert(row_y >= 0 && row_y < 22);
+        assert(x_start >= 0 && x_start <= x_end && x_end <= 40);
+        return std::span(tiles[layer][row_y] + x_start, x_end - x_start);
+    }
 };
 
 static_assert(sizeof(Room) == 0x1b88);
@@ -100,7 +116,8 @@ class Map {
     glm::ivec2 offset;
     glm::ivec2 size;
     std::vector<Room> rooms;
-    std::unordered_map<uint16_t, int> coordinate_map;
+    // room index for every possible room position (x | y << 8) or -1
+    std::vector<int16_t> coordinate_map;
 
     Map() = default;
 
@@ -121,6 +138,7 @@ class Map {
         world_wrap_x_start = head.world_wrap_x_start;
         world_wrap_x_end = head.world_wrap_x_end;
         rooms = {rooms_, rooms_ + head.roomCount};
+        coordinate_map.assign(256 * 256, -1);
 
         int x_min = 65535, x_max = 0;
         int y_min = 65535, y_max = 0;
@@ -134,6 +152,7 @@ class Map {
 
             coordinate_map[room.x | (room.y << 8)] = i;
         }
+        dirty_rooms.assign(rooms.size(), false);
 
         int width = x_max - x_min + 1;
         int height = y_max - y_min + 1;
@@ -142,47 +161,91 @@ class Map {
         size = {width, height};
     }
 
-    const Room* getRoom(glm::ivec2 pos) const {
-        if(pos.x < 0 || pos.x >= 256 || pos.y < 0 || pos.y >= 256)
-            return nullptr;
-        if(auto el = coordinate_map.find(pos.x | (pos.y << 8)); el != coordinate_map.end()) {
-            return &rooms[el->second];
+    // index into rooms or -1
+    int roomIndex(int x, int y) const {
+        if(x < 0 || x >= 256 || y < 0 || y >= 256 || coordinate_map.empty())
+            return -1;
+        return coordinate_map[x | (y << 8)];
+    }
+
+    // indices of the rooms in the room coordinate rectangle [min, max], row by row
+    std::vector<int> rooms_in(glm::ivec2 min, glm::ivec2 max) const {
+        min = glm::max(min, offset);
+        max = glm::min(max, offset + size - 1);
+
+        std::vector<int> result;
+        for(int y = min.y; y <= max.y; y++) {
+            for(int x = min.x; x <= max.x; x++) {
+                auto index = roomIndex(x, y);
+                if(index != -1) result.push_back(index);
+            }
         }
-        return nullptr;
+        return result;
+    }
+
+    const Room* getRoom(glm::ivec2 pos) const {
+        auto index = roomIndex(pos.x, pos.y);
+        return index == -1 ? nullptr : &rooms[index];
     }
     Room* getRoom(glm::ivec2 pos) {
-        if(pos.x < 0 || pos.x >= 256 || pos.y < 0 || pos.y >= 256)
-            return nullptr;
-        if(auto el = coordinate_map.find(pos.x | (pos.y << 8)); el != coordinate_map.end()) {
-            return &rooms[el->second];
-        }
-        return nullptr;
+        auto index = roomIndex(pos.x, pos.y);
+        return index == -1 ? nullptr : &rooms[index];
     }
 
     std::optional<MapTile> getTile(int layer, int x, int y) const {
-        auto rx = x / 40;
-        auto ry = y / 22;
-
-        if(rx < 0 || rx >= 256 || ry < 0 || ry >= 256)
+        if(x < 0 || y < 0)
             return std::nullopt;
+        auto index = roomIndex(x / 40, y / 22);
+        if(index == -1)
+            return std::nullopt;
+        return rooms[index].tiles[layer][y % 22][x % 40];
+    }
 
-        if(auto el = coordinate_map.find(rx | (ry << 8)); el != coordinate_map.end()) {
-            return rooms[el->second].tiles[layer][y % 22][x % 40];
+    void setTile(int layer, int x, int y, MapTile tile) {
+        if(x < 0 || y < 0)
+            return;
+        auto index = roomIndex(x / 40, y / 22);
+        if(index != -1) {
+            rooms[index].tiles[layer][y % 22][x % 40] = tile;
+            mark_dirty({x, y}, {1, 1});
         }
+    }
 
-        return std::nullopt;
+    // walks the world space rectangle [pos, pos + extent) room by room and calls fn(world_pos, tiles)
+    // for each row of it that lies inside a room. tiles is the contiguous part of that row, starting at world_pos.
+    // positions without a room are skipped
+    template<typename F>
+    void for_each_row(int layer, glm::ivec2 pos, glm::ivec2 extent, F&& fn) {
+        mark_dirty(pos, extent); // rows might get written
+        visit_rows(*this, layer, pos, extent, fn);
+    }
+    template<typename F>
+    void for_each_row(int layer, glm::ivec2 pos, glm::ivec2 extent, F&& fn) const {
+        visit_rows(*this, layer, pos, extent, fn);
     }
 
-    void setTile(int layer, int x, int y, MapTile tile) {
-        auto rx = x / 40;
-        auto ry = y / 22;
+    // marks the rooms whose geometry depends on tiles in [pos, pos + extent).
+    // contiguous tiles look at their neighbours. lamp ropes can reach through several rooms and are left to the renderer
+    void mark_dirty(glm::ivec2 pos, glm::ivec2 extent) {
+        if(extent.x <= 0 || extent.y <= 0) return;
+        auto end = pos + extent;
 
-        if(rx < 0 || rx >= 256 || ry < 0 || ry >= 256)
-            return;
+        for(int ry = std::max(floor_div(pos.y - 1, 22), 0); ry <= std::min(floor_div(end.y, 22), 255); ry++) {
+            for(int rx = std::max(floor_div(pos.x - 1, 40), 0); rx <= std::min(floor_div(end.x, 40), 255); rx++) {
+                auto index = roomIndex(rx, ry);
+                if(index != -1 && index < (int)dirty_rooms.size()) dirty_rooms[index] = true;
+            }
+        }
+    }
 
-        if(auto el = coordinate_map.find(rx | (ry << 8)); el != coordinate_map.end()) {
-            rooms[el->second].tiles[layer][y % 22][x % 40] = tile;
+    // indices of all rooms marked since the last call
+    std::vector<int> take_dirty_rooms() {
+        std::vector<int> result;
+        for(size_t i = 0; i < dirty_rooms.size(); i++) {
+            if(dirty_rooms[i]) result.push_back(i);
         }
+        dirty_rooms.assign(rooms.size(), false);
+        return result;
     }
 
     auto save() const {
@@ -202,4 +265,33 @@ class Map {
 
         return data;
     }
+
+  private:
+    // rooms that were edited since the renderer last looked
+    std::vector<bool> dirty_rooms;
+
+    static int floor_div(int a, int b) {
+        return a >= 0 ? a / b : (a - b + 1) / b;
+    }
+
+    template<typename M, typename F>
+    static void visit_rows(M& map, int layer, glm::ivec2 pos, glm::ivec2 extent, F& fn) {
+        if(extent.x <= 0 || extent.y <= 0) return;
+        auto end = pos + extent;
+
+        // only divide at the corners, everything inside is plain row offsets
+        for(int ry = std::max(floor_div(pos.y, 22), 0); ry <= std::min(floor_div(end.y - 1, 22), 255); ry++) {
+            for(int rx = std::max(floor_div(pos.x, 40), 0); rx <= std::min(floor_div(end.x - 1, 40), 255); rx++) {
+                auto index = map.roomIndex(rx, ry);
+                if(index == -1) continue;
+                auto& room = map.rooms[index];
+
+                int x0 = std::max(pos.x - rx * 40, 0), x1 = std::min(end.x - rx * 40, 40);
+                int y0 = std::max(pos.y - ry * 22, 0), y1 = std::min(end.y - ry * 22, 22);
+                for(int y = y0; y < y1; y++) {
+                    fn(glm::ivec2(rx * 40 + x0, ry * 22 + y), room.row(layer, y, x0, x1));
+                }
+            }
+        }
+    }
 };
@@ -17,7 +17,7 @@ static int search_order(const SearchResult& el, int ColumnIndex, const GameData&
         case 1: return el.layer;
         case 2: return el.room_pos.x * 40 + el.tile_pos.x;
         case 3: return el.room_pos.y * 22 + el.tile_pos.y;
-        case 4: return game_data.maps[el.map].getRoom(el.room_pos)->tiles[el.layer][el.tile_pos.y][el.tile_pos.x].param;
+        case 4: return game_data.map(el.map).getRoom(el.room_pos)->tiles[el.layer][el.tile_pos.y][el.tile_pos.x].param;
         case 5: return el.room_pos.x;
         case 6: return el.room_pos.y;
         case 7: return el.tile_pos.x;
@@ -95,7 +95,7 @@ void SearchWindow::draw(const GameData& game_data, std::function<void(int, glm::
 
                     auto el = results[row];
                     auto pos = el.room_pos * Room::size + el.tile_pos;
-                    auto tile = game_data.maps[el.map].getTile(el.layer, pos.x, pos.y);
+                    auto tile = game_data.map(el.map).getTile(el.layer, pos.x, pos.y);
 
                     // clang-format off
                     ImGui::TableSetColumnIndex(0); ImGui::Text("%s", mapNames[el.map]);
@@ -131,19 +131,19 @@ void SearchWindow::search(const GameData& game_data) {
     results.clear();
     searched_tile = tile_id;
 
-    for(size_t i = 0; i < game_data.maps.size(); i++) {
-        auto& map = game_data.maps[i];
+    for(size_t i = 0; i < 5; i++) {
+        auto& map = game_data.map(i);
 
         for(auto& room : map.rooms) {
             for(int y = 0; y < 22; y++) {
+                auto fg = room.row(0, y);
+                auto bg = room.row(1, y);
+
                 for(int x = 0; x < 40; x++) {
-                    auto tile1 = room.tiles[0][y][x];
-                    if(tile1.tile_id == tile_id) {
+                    if(fg[x].tile_id == tile_id) {
                         results.push_back(SearchResult {(uint8_t)i, 0, glm::ivec2(room.x, room.y), glm::ivec2(x, y)});
                     }
-
-                    auto tile2 = room.tiles[1][y][x];
-                    if(tile2.tile_id == tile_id) {
+                    if(bg[x].tile_id == tile_id) {
                         results.push_back(SearchResult {(uint8_t)i, 1, glm::ivec2(room.x, room.y), glm::ivec2(x, y)});
                     }
                 }
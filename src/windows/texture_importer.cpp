@@ -125,7 +125,9 @@ void TextureImporter::apply() {
     game_data.uvs[selected_tile].pos = insert_pos;
     game_data.uvs[selected_tile].size = {image.width(), image.height()};
 
-    image.copy_to(game_data.atlas, insert_pos.x, insert_pos.y);
+    image.copy_to(game_data.atlas(), insert_pos.x, insert_pos.y);
+    game_data.mark_dirty(254);
+    game_data.mark_dirty(255);
 
     render_data->textures.update();
     updateGeometry = true;
@@ -148,7 +150,7 @@ void TextureImporter::draw() {
         if(ImGui::InputInt2("position", &insert_pos.x)) {
             selected_tile = -1;
 
-            auto atlas_size = glm::ivec2(game_data.atlas.width(), game_data.atlas.height());
+            auto atlas_size = glm::ivec2(game_data.atlas().width(), game_data.atlas().height());
             auto image_size = glm::ivec2(image.width(), image.height());
             insert_pos = glm::clamp(insert_pos, glm::ivec2(0), atlas_size - image_size);
         }
@@ -168,7 +170,7 @@ void TextureImporter::drawCanvas() {
     ImGui::PopStyleColor();
     ImGui::PopStyleVar();
 
-    auto atlas_size = glm::ivec2(game_data.atlas.width(), game_data.atlas.height()) * scale;
+    auto atlas_size = glm::ivec2(game_data.atlas().width(), game_data.atlas().height()) * scale;
     auto image_size = glm::ivec2(image.width(), image.height()) * scale;
 
     ImGui::Image((ImTextureID)render_data->textures.atlas.id.value, ImVec2(atlas_size.x, atlas_size.y));
@@ -15,10 +15,10 @@ static ImVec2 toImVec(const glm::vec2 vec) {
 
 Texture& get_tex_for_tile(int tile_id) {
     if(tile_id == 794) {
-        return render_data->textures.bunny;
+        return render_data->textures.get_bunny();
     }
     if(tile_id == 793) {
-        return render_data->textures.time_capsule;
+        return render_data->textures.get_time_capsule();
     }
     return render_data->textures.atlas;
 }
@@ -123,9 +123,13 @@ void TileViewer::draw(GameData& game_data, bool& should_update) {
     auto& uv = game_data.uvs[selected_tile];
 
     ImGui::SeparatorText("Tile Data");
-    should_update |= DrawUvFlags(uv);
-    should_update |= ImGui::InputScalarN("UV", ImGuiDataType_U16, &uv.pos, 2);
-    should_update |= ImGui::InputScalarN("UV Size", ImGuiDataType_U16, &uv.size, 2);
+    bool uv_changed = DrawUvFlags(uv);
+    uv_changed |= ImGui::InputScalarN("UV", ImGuiDataType_U16, &uv.pos, 2);
+    uv_changed |= ImGui::InputScalarN("UV Size", ImGuiDataType_U16, &uv.size, 2);
+    if(uv_changed) {
+        game_data.mark_dirty(254);
+        should_update = true;
+    }
 
     if(ImGui::Button("Import texture")) {
         texture_importer.open(selected_tile);
@@ -157,12 +161,14 @@ void TileViewer::draw(GameData& game_data, bool& should_update) {
                 ImGui::PushMultiItemsWidths(2, ImGui::CalcItemWidth());
                 if(ImGui::SliderScalar("##min", ImGuiDataType_U16, &anim.start, &min, &max)) {
                     anim.end = std::clamp(anim.end, anim.start, max);
+                    game_data.mark_sprite_dirty(selected_tile);
                 }
                 ImGui::PopItemWidth();
                 ImGui::SameLine(0, inner_spacing);
 
                 if(ImGui::SliderScalar("##max", ImGuiDataType_U16, &anim.end, &min, &max)) {
                     anim.start = std::clamp(anim.start, min, anim.end);
+                    game_data.mark_sprite_dirty(selected_tile);
                 }
                 ImGui::PopItemWidth();
                 ImGui::SameLine(0, inner_spacing);
@@ -172,8 +178,10 @@ void TileViewer::draw(GameData& game_data, bool& should_update) {
 
             int type = anim.type;
             static const char* names[3] {"forward", "backward", "alternating"};
-            ImGui::Combo("type", &type, names, 3);
-            anim.type = (uint16_t)type;
+            if(ImGui::Combo("type", &type, names, 3)) {
+                anim.type = (uint16_t)type;
+                game_data.mark_sprite_dirty(selected_tile);
+            }
 
             if(playing) {
                 if(anim.start < anim.end) {